@@ -22,59 +22,369 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
 
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <thread>
 #include <tuple>
+#include <vector>
 
 #include "ReduceFlicker.h"
+#include "fetch_order.h"
 #include "proc_filter.h"
+#include "readahead.h"
+#include "thread_pool.h"
 
 
 
 
-proc_filter_t
-get_main_proc(int strength, bool aggressive, arch_t arch)
+/*
+ * The kernels are keyed by sample size: 8, 16 or 32 (float) bits. SSE2 has
+ * no unsigned 16-bit min/max, so with it samples of up to 10 bits are keyed
+ * 10 and use the signed ones.
+ */
+static int get_kernel_bits(int bits, arch_t arch)
+{
+    if (bits > 8 && bits < 32) {
+        return arch == USE_SSE2 && bits <= 10 ? 10 : 16;
+    }
+    return bits;
+}
+
+
+template <bool ALIGNED>
+static proc_filter_t
+get_main_proc(int strength, bool aggressive, int bits, arch_t arch)
 {
     using std::make_tuple;
 
-    std::map<std::tuple<int, bool, arch_t>, proc_filter_t> func;
+    std::map<std::tuple<int, bool, int, arch_t>, proc_filter_t> func;
+
+    func[make_tuple(1, false, 8, NO_SIMD)] = proc_c<uint8_t, int, 1>;
+    func[make_tuple(2, false, 8, NO_SIMD)] = proc_c<uint8_t, int, 2>;
+    func[make_tuple(3, false, 8, NO_SIMD)] = proc_c<uint8_t, int, 3>;
+    func[make_tuple(1, false, 16, NO_SIMD)] = proc_c<uint16_t, int, 1>;
+    func[make_tuple(2, false, 16, NO_SIMD)] = proc_c<uint16_t, int, 2>;
+    func[make_tuple(3, false, 16, NO_SIMD)] = proc_c<uint16_t, int, 3>;
+    func[make_tuple(1, false, 32, NO_SIMD)] = proc_c<float, float, 1>;
+    func[make_tuple(2, false, 32, NO_SIMD)] = proc_c<float, float, 2>;
+    func[make_tuple(3, false, 32, NO_SIMD)] = proc_c<float, float, 3>;
+
+    func[make_tuple(1, true, 8, NO_SIMD)] = proc_a_c<uint8_t, int, 1>;
+    func[make_tuple(2, true, 8, NO_SIMD)] = proc_a_c<uint8_t, int, 2>;
+    func[make_tuple(3, true, 8, NO_SIMD)] = proc_a_c<uint8_t, int, 3>;
+    func[make_tuple(1, true, 16, NO_SIMD)] = proc_a_c<uint16_t, int, 1>;
+    func[make_tuple(2, true, 16, NO_SIMD)] = proc_a_c<uint16_t, int, 2>;
+    func[make_tuple(3, true, 16, NO_SIMD)] = proc_a_c<uint16_t, int, 3>;
+    func[make_tuple(1, true, 32, NO_SIMD)] = proc_a_c<float, float, 1>;
+    func[make_tuple(2, true, 32, NO_SIMD)] = proc_a_c<float, float, 2>;
+    func[make_tuple(3, true, 32, NO_SIMD)] = proc_a_c<float, float, 3>;
+
+    func[make_tuple(1, false, 8, USE_SSE2)] = proc_simd<uint8_t, __m128i, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, false, 8, USE_SSE2)] = proc_simd<uint8_t, __m128i, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, false, 8, USE_SSE2)] = proc_simd<uint8_t, __m128i, 3, USE_SSE2, ALIGNED>;
+    func[make_tuple(1, false, 10, USE_SSE2)] = proc_simd<int16_t, __m128i, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, false, 10, USE_SSE2)] = proc_simd<int16_t, __m128i, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, false, 10, USE_SSE2)] = proc_simd<int16_t, __m128i, 3, USE_SSE2, ALIGNED>;
+    func[make_tuple(1, false, 16, USE_SSE2)] = proc_simd<uint16_t, __m128i, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, false, 16, USE_SSE2)] = proc_simd<uint16_t, __m128i, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, false, 16, USE_SSE2)] = proc_simd<uint16_t, __m128i, 3, USE_SSE2, ALIGNED>;
+    func[make_tuple(1, false, 32, USE_SSE2)] = proc_simd<float, __m128, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, false, 32, USE_SSE2)] = proc_simd<float, __m128, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, false, 32, USE_SSE2)] = proc_simd<float, __m128, 3, USE_SSE2, ALIGNED>;
+
+    func[make_tuple(1, true, 8, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, true, 8, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, true, 8, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE2, ALIGNED>;
+    func[make_tuple(1, true, 10, USE_SSE2)] = proc_a_simd<int16_t, __m128i, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, true, 10, USE_SSE2)] = proc_a_simd<int16_t, __m128i, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, true, 10, USE_SSE2)] = proc_a_simd<int16_t, __m128i, 3, USE_SSE2, ALIGNED>;
+    func[make_tuple(1, true, 16, USE_SSE2)] = proc_a_simd<uint16_t, __m128i, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, true, 16, USE_SSE2)] = proc_a_simd<uint16_t, __m128i, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, true, 16, USE_SSE2)] = proc_a_simd<uint16_t, __m128i, 3, USE_SSE2, ALIGNED>;
+    func[make_tuple(1, true, 32, USE_SSE2)] = proc_a_simd<float, __m128, 1, USE_SSE2, ALIGNED>;
+    func[make_tuple(2, true, 32, USE_SSE2)] = proc_a_simd<float, __m128, 2, USE_SSE2, ALIGNED>;
+    func[make_tuple(3, true, 32, USE_SSE2)] = proc_a_simd<float, __m128, 3, USE_SSE2, ALIGNED>;
+
+    func[make_tuple(1, false, 8, USE_SSE41)] = proc_simd<uint8_t, __m128i, 1, USE_SSE41, ALIGNED>;
+    func[make_tuple(2, false, 8, USE_SSE41)] = proc_simd<uint8_t, __m128i, 2, USE_SSE41, ALIGNED>;
+    func[make_tuple(3, false, 8, USE_SSE41)] = proc_simd<uint8_t, __m128i, 3, USE_SSE41, ALIGNED>;
+    func[make_tuple(1, false, 16, USE_SSE41)] = proc_simd<uint16_t, __m128i, 1, USE_SSE41, ALIGNED>;
+    func[make_tuple(2, false, 16, USE_SSE41)] = proc_simd<uint16_t, __m128i, 2, USE_SSE41, ALIGNED>;
+    func[make_tuple(3, false, 16, USE_SSE41)] = proc_simd<uint16_t, __m128i, 3, USE_SSE41, ALIGNED>;
+    func[make_tuple(1, false, 32, USE_SSE41)] = proc_simd<float, __m128, 1, USE_SSE41, ALIGNED>;
+    func[make_tuple(2, false, 32, USE_SSE41)] = proc_simd<float, __m128, 2, USE_SSE41, ALIGNED>;
+    func[make_tuple(3, false, 32, USE_SSE41)] = proc_simd<float, __m128, 3, USE_SSE41, ALIGNED>;
+
+    func[make_tuple(1, true, 8, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE41, ALIGNED>;
+    func[make_tuple(2, true, 8, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE41, ALIGNED>;
+    func[make_tuple(3, true, 8, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE41, ALIGNED>;
+    func[make_tuple(1, true, 16, USE_SSE41)] = proc_a_simd<uint16_t, __m128i, 1, USE_SSE41, ALIGNED>;
+    func[make_tuple(2, true, 16, USE_SSE41)] = proc_a_simd<uint16_t, __m128i, 2, USE_SSE41, ALIGNED>;
+    func[make_tuple(3, true, 16, USE_SSE41)] = proc_a_simd<uint16_t, __m128i, 3, USE_SSE41, ALIGNED>;
+    func[make_tuple(1, true, 32, USE_SSE41)] = proc_a_simd<float, __m128, 1, USE_SSE41, ALIGNED>;
+    func[make_tuple(2, true, 32, USE_SSE41)] = proc_a_simd<float, __m128, 2, USE_SSE41, ALIGNED>;
+    func[make_tuple(3, true, 32, USE_SSE41)] = proc_a_simd<float, __m128, 3, USE_SSE41, ALIGNED>;
+#if defined(__AVX2__)
+    func[make_tuple(1, false, 8, USE_AVX2)] = proc_simd<uint8_t, __m256i, 1, USE_AVX2, ALIGNED>;
+    func[make_tuple(2, false, 8, USE_AVX2)] = proc_simd<uint8_t, __m256i, 2, USE_AVX2, ALIGNED>;
+    func[make_tuple(3, false, 8, USE_AVX2)] = proc_simd<uint8_t, __m256i, 3, USE_AVX2, ALIGNED>;
+    func[make_tuple(1, false, 16, USE_AVX2)] = proc_simd<uint16_t, __m256i, 1, USE_AVX2, ALIGNED>;
+    func[make_tuple(2, false, 16, USE_AVX2)] = proc_simd<uint16_t, __m256i, 2, USE_AVX2, ALIGNED>;
+    func[make_tuple(3, false, 16, USE_AVX2)] = proc_simd<uint16_t, __m256i, 3, USE_AVX2, ALIGNED>;
+    func[make_tuple(1, false, 32, USE_AVX2)] = proc_simd<float, __m256, 1, USE_AVX2, ALIGNED>;
+    func[make_tuple(2, false, 32, USE_AVX2)] = proc_simd<float, __m256, 2, USE_AVX2, ALIGNED>;
+    func[make_tuple(3, false, 32, USE_AVX2)] = proc_simd<float, __m256, 3, USE_AVX2, ALIGNED>;
+
+    func[make_tuple(1, true, 8, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 1, USE_AVX2, ALIGNED>;
+    func[make_tuple(2, true, 8, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 2, USE_AVX2, ALIGNED>;
+    func[make_tuple(3, true, 8, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 3, USE_AVX2, ALIGNED>;
+    func[make_tuple(1, true, 16, USE_AVX2)] = proc_a_simd<uint16_t, __m256i, 1, USE_AVX2, ALIGNED>;
+    func[make_tuple(2, true, 16, USE_AVX2)] = proc_a_simd<uint16_t, __m256i, 2, USE_AVX2, ALIGNED>;
+    func[make_tuple(3, true, 16, USE_AVX2)] = proc_a_simd<uint16_t, __m256i, 3, USE_AVX2, ALIGNED>;
+    func[make_tuple(1, true, 32, USE_AVX2)] = proc_a_simd<float, __m256, 1, USE_AVX2, ALIGNED>;
+    func[make_tuple(2, true, 32, USE_AVX2)] = proc_a_simd<float, __m256, 2, USE_AVX2, ALIGNED>;
+    func[make_tuple(3, true, 32, USE_AVX2)] = proc_a_simd<float, __m256, 3, USE_AVX2, ALIGNED>;
+#endif
+    return func[make_tuple(strength, aggressive, bits, arch)];
+}
 
-    func[make_tuple(1, false, NO_SIMD)] = proc_c<1>;
-    func[make_tuple(2, false, NO_SIMD)] = proc_c<2>;
-    func[make_tuple(3, false, NO_SIMD)] = proc_c<3>;
 
-    func[make_tuple(1, true, NO_SIMD)] = proc_a_c<1>;
-    func[make_tuple(2, true, NO_SIMD)] = proc_a_c<2>;
-    func[make_tuple(3, true, NO_SIMD)] = proc_a_c<3>;
+/*
+ * Packed formats are 8 bits per sample, and are processed as one plane of
+ * bytes. keep selects the channels which are copied from curr.
+ */
+template <bool ALIGNED>
+static proc_filter_t
+get_packed_proc(int strength, bool aggressive, uint32_t keep, arch_t arch)
+{
+    using std::make_tuple;
 
-    func[make_tuple(1, false, USE_SSE2)] = proc_simd<__m128i, 1>;
-    func[make_tuple(2, false, USE_SSE2)] = proc_simd<__m128i, 2>;
-    func[make_tuple(3, false, USE_SSE2)] = proc_simd<__m128i, 3>;
+    if (keep == 0) {
+        return get_main_proc<ALIGNED>(strength, aggressive, 8, arch);
+    }
 
-    func[make_tuple(1, true, USE_SSE2)] = proc_a_simd<__m128i, 1>;
-    func[make_tuple(2, true, USE_SSE2)] = proc_a_simd<__m128i, 2>;
-    func[make_tuple(3, true, USE_SSE2)] = proc_a_simd<__m128i, 3>;
-#if defined(__AVX2__)
-    func[make_tuple(1, false, USE_AVX2)] = proc_simd<__m256i, 1>;
-    func[make_tuple(2, false, USE_AVX2)] = proc_simd<__m256i, 2>;
-    func[make_tuple(3, false, USE_AVX2)] = proc_simd<__m256i, 3>;
+    std::map<std::tuple<int, bool, uint32_t, arch_t>, proc_filter_t> func;
+
+    func[make_tuple(1, false, KEEP_ALPHA, NO_SIMD)] = proc_c<uint8_t, int, 1, KEEP_ALPHA>;
+    func[make_tuple(2, false, KEEP_ALPHA, NO_SIMD)] = proc_c<uint8_t, int, 2, KEEP_ALPHA>;
+    func[make_tuple(3, false, KEEP_ALPHA, NO_SIMD)] = proc_c<uint8_t, int, 3, KEEP_ALPHA>;
+    func[make_tuple(1, true, KEEP_ALPHA, NO_SIMD)] = proc_a_c<uint8_t, int, 1, KEEP_ALPHA>;
+    func[make_tuple(2, true, KEEP_ALPHA, NO_SIMD)] = proc_a_c<uint8_t, int, 2, KEEP_ALPHA>;
+    func[make_tuple(3, true, KEEP_ALPHA, NO_SIMD)] = proc_a_c<uint8_t, int, 3, KEEP_ALPHA>;
+
+    func[make_tuple(1, false, KEEP_CHROMA, NO_SIMD)] = proc_c<uint8_t, int, 1, KEEP_CHROMA>;
+    func[make_tuple(2, false, KEEP_CHROMA, NO_SIMD)] = proc_c<uint8_t, int, 2, KEEP_CHROMA>;
+    func[make_tuple(3, false, KEEP_CHROMA, NO_SIMD)] = proc_c<uint8_t, int, 3, KEEP_CHROMA>;
+    func[make_tuple(1, true, KEEP_CHROMA, NO_SIMD)] = proc_a_c<uint8_t, int, 1, KEEP_CHROMA>;
+    func[make_tuple(2, true, KEEP_CHROMA, NO_SIMD)] = proc_a_c<uint8_t, int, 2, KEEP_CHROMA>;
+    func[make_tuple(3, true, KEEP_CHROMA, NO_SIMD)] = proc_a_c<uint8_t, int, 3, KEEP_CHROMA>;
+
+    func[make_tuple(1, false, KEEP_ALPHA, USE_SSE2)] = proc_simd<uint8_t, __m128i, 1, USE_SSE2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(2, false, KEEP_ALPHA, USE_SSE2)] = proc_simd<uint8_t, __m128i, 2, USE_SSE2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(3, false, KEEP_ALPHA, USE_SSE2)] = proc_simd<uint8_t, __m128i, 3, USE_SSE2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(1, true, KEEP_ALPHA, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(2, true, KEEP_ALPHA, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(3, true, KEEP_ALPHA, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE2, ALIGNED, KEEP_ALPHA>;
+
+    func[make_tuple(1, false, KEEP_CHROMA, USE_SSE2)] = proc_simd<uint8_t, __m128i, 1, USE_SSE2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(2, false, KEEP_CHROMA, USE_SSE2)] = proc_simd<uint8_t, __m128i, 2, USE_SSE2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(3, false, KEEP_CHROMA, USE_SSE2)] = proc_simd<uint8_t, __m128i, 3, USE_SSE2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(1, true, KEEP_CHROMA, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(2, true, KEEP_CHROMA, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(3, true, KEEP_CHROMA, USE_SSE2)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE2, ALIGNED, KEEP_CHROMA>;
+
+    func[make_tuple(1, false, KEEP_ALPHA, USE_SSE41)] = proc_simd<uint8_t, __m128i, 1, USE_SSE41, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(2, false, KEEP_ALPHA, USE_SSE41)] = proc_simd<uint8_t, __m128i, 2, USE_SSE41, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(3, false, KEEP_ALPHA, USE_SSE41)] = proc_simd<uint8_t, __m128i, 3, USE_SSE41, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(1, true, KEEP_ALPHA, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE41, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(2, true, KEEP_ALPHA, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE41, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(3, true, KEEP_ALPHA, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE41, ALIGNED, KEEP_ALPHA>;
+
+    func[make_tuple(1, false, KEEP_CHROMA, USE_SSE41)] = proc_simd<uint8_t, __m128i, 1, USE_SSE41, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(2, false, KEEP_CHROMA, USE_SSE41)] = proc_simd<uint8_t, __m128i, 2, USE_SSE41, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(3, false, KEEP_CHROMA, USE_SSE41)] = proc_simd<uint8_t, __m128i, 3, USE_SSE41, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(1, true, KEEP_CHROMA, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE41, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(2, true, KEEP_CHROMA, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE41, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(3, true, KEEP_CHROMA, USE_SSE41)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE41, ALIGNED, KEEP_CHROMA>;
 
-    func[make_tuple(1, true, USE_AVX2)] = proc_a_simd<__m256i, 1>;
-    func[make_tuple(2, true, USE_AVX2)] = proc_a_simd<__m256i, 2>;
-    func[make_tuple(3, true, USE_AVX2)] = proc_a_simd<__m256i, 3>;
+#if defined(__AVX2__)
+    func[make_tuple(1, false, KEEP_ALPHA, USE_AVX2)] = proc_simd<uint8_t, __m256i, 1, USE_AVX2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(2, false, KEEP_ALPHA, USE_AVX2)] = proc_simd<uint8_t, __m256i, 2, USE_AVX2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(3, false, KEEP_ALPHA, USE_AVX2)] = proc_simd<uint8_t, __m256i, 3, USE_AVX2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(1, true, KEEP_ALPHA, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 1, USE_AVX2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(2, true, KEEP_ALPHA, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 2, USE_AVX2, ALIGNED, KEEP_ALPHA>;
+    func[make_tuple(3, true, KEEP_ALPHA, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 3, USE_AVX2, ALIGNED, KEEP_ALPHA>;
+
+    func[make_tuple(1, false, KEEP_CHROMA, USE_AVX2)] = proc_simd<uint8_t, __m256i, 1, USE_AVX2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(2, false, KEEP_CHROMA, USE_AVX2)] = proc_simd<uint8_t, __m256i, 2, USE_AVX2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(3, false, KEEP_CHROMA, USE_AVX2)] = proc_simd<uint8_t, __m256i, 3, USE_AVX2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(1, true, KEEP_CHROMA, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 1, USE_AVX2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(2, true, KEEP_CHROMA, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 2, USE_AVX2, ALIGNED, KEEP_CHROMA>;
+    func[make_tuple(3, true, KEEP_CHROMA, USE_AVX2)] = proc_a_simd<uint8_t, __m256i, 3, USE_AVX2, ALIGNED, KEEP_CHROMA>;
 #endif
-    return func[make_tuple(strength, aggressive, arch)];
+    return func[make_tuple(strength, aggressive, keep, arch)];
+}
+
+
+/*
+ * Whether the aligned kernels can read a plane: each row starts on an align
+ * byte boundary and is followed by padding up to the next one.
+ */
+static bool
+is_aligned_plane(const uint8_t* p, int pitch, int rowsize, size_t align)
+{
+    const int padded = static_cast<int>((rowsize + align - 1) & ~(align - 1));
+    return reinterpret_cast<uintptr_t>(p) % align == 0 && pitch > 0
+        && pitch % align == 0 && pitch >= padded;
+}
+
+
+
+namespace {
+// the pointers and pitches of one plane of the frames a GetFrame() reads.
+struct plane_t {
+    proc_filter_t proc;
+    uint8_t* dstp;
+    const uint8_t* currp;
+    const uint8_t* prevp[3];
+    const uint8_t* nextp[3];
+    int dpitch;
+    int cpitch;
+    int ppitch[3];
+    int npitch[3];
+    int width;
+    int height;
+};
+
+struct stripe_t {
+    const plane_t* plane;
+    int y;
+    int rows;
+};
+
+// the stripes of one frame, shared by the jobs through next.
+struct job_data_t {
+    const std::function<void(size_t)>* job;
+    size_t count;
+    std::atomic<size_t> next;
+};
+}
+
+
+static void
+proc_stripe(const plane_t& pd, int y, int rows, int strength)
+{
+    if (!pd.proc) {
+        // a plane which is not processed is copied from curr.
+        for (int i = y; i < y + rows; ++i) {
+            memcpy(pd.dstp + i * pd.dpitch, pd.currp + i * pd.cpitch, pd.width);
+        }
+        return;
+    }
+    const uint8_t *prevp[3], *nextp[3];
+    for (int i = 0; i < (strength > 2 ? 3 : 2); ++i) {
+        prevp[i] = pd.prevp[i] + y * pd.ppitch[i];
+    }
+    for (int i = 0; i < strength; ++i) {
+        nextp[i] = pd.nextp[i] + y * pd.npitch[i];
+    }
+    pd.proc(pd.dstp + y * pd.dpitch, prevp, pd.currp + y * pd.cpitch, nextp,
+            pd.dpitch, pd.ppitch, pd.cpitch, pd.npitch, pd.width, rows);
+}
+
+
+static AVSValue __stdcall take_stripes(IScriptEnvironment2*, void* data)
+{
+    auto jd = reinterpret_cast<job_data_t*>(data);
+    size_t i;
+    while ((i = jd->next.fetch_add(1)) < jd->count) {
+        (*jd->job)(i);
+    }
+    return AVSValue();
+}
+
+
+/*
+ * Calls job(0) ... job(count - 1) on num_jobs jobs of the AviSynth+ thread
+ * pool and the calling thread, and returns when all of them are done.
+ */
+static void
+run_jobs(IScriptEnvironment2* env, int num_jobs, size_t count,
+         const std::function<void(size_t)>& job)
+{
+    num_jobs = static_cast<int>(std::min<size_t>(num_jobs, count - 1));
+    if (num_jobs < 1) {
+        for (size_t i = 0; i < count; ++i) {
+            job(i);
+        }
+        return;
+    }
+
+    job_data_t jd;
+    jd.job = &job;
+    jd.count = count;
+    jd.next = 0;
+
+    IJobCompletion* completion = env->NewCompletion(num_jobs);
+    for (int i = 0; i < num_jobs; ++i) {
+        env->ParallelJob(take_stripes, &jd, completion);
+    }
+    take_stripes(env, &jd);
+    completion->Wait();
+    completion->Destroy();
 }
 
 
 
 ReduceFlicker::
-ReduceFlicker(PClip c, int s, bool aggressive, bool grey, arch_t arch, bool ra) :
-    GenericVideoFilter(c), strength(s), raccess(ra)
+ReduceFlicker(PClip c, int s, bool aggressive, bool grey, bool alpha,
+              arch_t arch, int bits, bool ra, bool autoorder, int threads,
+              int readahead, const PClip* prev, const PClip* next,
+              bool avsplus) :
+    GenericVideoFilter(c), strength(s), numThreads(threads), pool(nullptr),
+    readAhead(nullptr)
 {
-    numPlanes = vi.IsY8() || grey ? 1 : 3;
+    for (int i = 0; i < 3; ++i) {
+        neighbors[2 - i] = prev[i];
+        neighbors[4 + i] = next[i];
+    }
+    fetchOrder = new FetchOrder(ra ? ORDER_DESCENDING : ORDER_ASCENDING,
+                                autoorder);
+    // avs2.6 has no job facility, so the stripes are run on our own threads.
+    if (numThreads > 1 && !avsplus) {
+        pool = new ThreadPool(numThreads - 1);
+    }
     align = arch == USE_AVX2 ? 32 : 16;
-    mainProc = get_main_proc(strength, aggressive, arch);
+    hasAlpha = false;
+    procAlpha = alpha;
+    if (!vi.IsPlanar()) {
+        // YUY2, RGB24 and RGB32 are one plane of bytes.
+        numPlanes = 1;
+        uint32_t keep = vi.IsRGB32() && !alpha ? KEEP_ALPHA
+                      : vi.IsYUY2() && grey ? KEEP_CHROMA : 0;
+        mainProc = get_packed_proc<true>(strength, aggressive, keep, arch);
+        unalignedProc = get_packed_proc<false>(strength, aggressive, keep, arch);
+    } else {
+        numPlanes = vi.IsY8() || vi.IsY() || grey ? 1 : 3;
+        hasAlpha = avsplus && vi.NumComponents() == 4;
+        bits = get_kernel_bits(bits, arch);
+        mainProc = get_main_proc<true>(strength, aggressive, bits, arch);
+        unalignedProc = get_main_proc<false>(strength, aggressive, bits, arch);
+    }
     child->SetCacheHints(CACHE_WINDOW, strength == 3 ? 7 : 5);
+    if (readahead > 0) {
+        readAhead = new ReadAhead(child, vi.num_frames, readahead);
+    }
+}
+
+
+ReduceFlicker::~ReduceFlicker()
+{
+    delete readAhead;
+    delete pool;
+    delete fetchOrder;
 }
 
 
@@ -83,98 +393,116 @@ PVideoFrame __stdcall ReduceFlicker::GetFrame(int n, ise_t* env)
     PVideoFrame curr, prev[3], next[3];
     const int nf = vi.num_frames - 1;
 
-    if (raccess) {
-        switch (strength) {
-        case 3:
-            next[2] = child->GetFrame(std::min(n + 3, nf), env);
-            next[1] = child->GetFrame(std::min(n + 2, nf), env);
-            next[0] = child->GetFrame(std::min(n + 1, nf), env);
-            curr = child->GetFrame(n, env);
-            prev[0] = child->GetFrame(std::max(n - 1, 0), env);
-            prev[1] = child->GetFrame(std::max(n - 2, 0), env);
-            prev[2] = child->GetFrame(std::max(n - 3, 0), env);
-            break;
-        case 2:
-            next[1] = child->GetFrame(std::min(n + 2, nf), env);
-            next[0] = child->GetFrame(std::min(n + 1, nf), env);
-            curr = child->GetFrame(n, env);
-            prev[0] = child->GetFrame(std::max(n - 1, 0), env);
-            prev[1] = child->GetFrame(std::max(n - 2, 0), env);
-            break;
-        default:
-            next[0] = child->GetFrame(std::min(n + 1, nf), env);
-            curr = child->GetFrame(n, env);
-            prev[1] = child->GetFrame(std::max(n - 2, 0), env);
-            prev[0] = child->GetFrame(std::max(n - 1, 0), env);
-        }
-    } else {
-        switch (strength) {
-        case 3:
-            prev[2] = child->GetFrame(std::max(n - 3, 0), env);
-            prev[1] = child->GetFrame(std::max(n - 2, 0), env);
-            prev[0] = child->GetFrame(std::max(n - 1, 0), env);
-            curr = child->GetFrame(n, env);
-            next[0] = child->GetFrame(std::min(n + 1, nf), env);
-            next[1] = child->GetFrame(std::min(n + 2, nf), env);
-            next[2] = child->GetFrame(std::min(n + 3, nf), env);
-            break;
-        case 2:
-            prev[1] = child->GetFrame(std::max(n - 2, 0), env);
-            prev[0] = child->GetFrame(std::max(n - 1, 0), env);
-            curr = child->GetFrame(n, env);
-            next[0] = child->GetFrame(std::min(n + 1, nf), env);
-            next[1] = child->GetFrame(std::min(n + 1, nf), env);
-            break;
-        default:
-            prev[1] = child->GetFrame(std::max(n - 2, 0), env);
-            prev[0] = child->GetFrame(std::max(n - 1, 0), env);
-            curr = child->GetFrame(n, env);
-            next[0] = child->GetFrame(std::min(n + 1, nf), env);
+    auto get_frame = [&](int i) {
+        return readAhead ? readAhead->getFrame(i, env) : child->GetFrame(i, env);
+    };
+
+    // the window from its first frame to its last. see fetch_order.h for
+    // how the order is chosen.
+    PVideoFrame* window[] = {
+        &prev[2], &prev[1], &prev[0], &curr, &next[0], &next[1], &next[2]
+    };
+    const int first = strength == 3 ? 0 : 1;
+    const int last = 3 + strength;
+
+    int probe;
+    const fetch_order_t order = fetchOrder->begin(probe);
+    try {
+        for (int j = first; j <= last; ++j) {
+            const int i = order == ORDER_ASCENDING ? j : first + last - j;
+            *window[i] = neighbors[i] ? neighbors[i]->GetFrame(n, env)
+                       : get_frame(std::min(std::max(n + i - 3, 0), nf));
         }
+    } catch (...) {
+        fetchOrder->cancel(probe);
+        throw;
+    }
+    fetchOrder->end(probe);
+
+    // the frames after the window are fetched while this one is filtered.
+    if (readAhead) {
+        readAhead->schedule(n, std::min(n + strength, nf), env);
     }
 
     PVideoFrame dst = env->NewVideoFrame(vi, align);
 
-    const int planes[] = {PLANAR_Y, PLANAR_U, PLANAR_V};
-    for (int p = 0; p < numPlanes; ++p) {
-        const int plane = planes[p];
-        
-        const int width = curr->GetRowSize(plane);
-        const int height = curr->GetHeight(plane);
-        const int cpitch = curr->GetPitch(plane);
-        const int dpitch = dst->GetPitch(plane);
-        const uint8_t* currp = curr->GetReadPtr(plane);
-        uint8_t* dstp = dst->GetWritePtr(plane);
-        
-        const uint8_t *prevp[3], *nextp[3];
-        int ppitch[3], npitch[3];
+    const int planes[] = {PLANAR_Y, PLANAR_U, PLANAR_V, PLANAR_A};
+    plane_t pdata[4];
+    std::vector<stripe_t> stripes;
+    for (int p = 0; p < numPlanes + (hasAlpha ? 1 : 0); ++p) {
+        const int plane = p < numPlanes ? planes[p] : PLANAR_A;
+        plane_t& pd = pdata[p];
+
+        pd.width = curr->GetRowSize(plane);
+        pd.height = curr->GetHeight(plane);
+        pd.cpitch = curr->GetPitch(plane);
+        pd.dpitch = dst->GetPitch(plane);
+        pd.currp = curr->GetReadPtr(plane);
+        pd.dstp = dst->GetWritePtr(plane);
+
         switch (strength) {
         case 3:
-            prevp[2] = prev[2]->GetReadPtr(plane);
-            ppitch[2] = prev[2]->GetPitch(plane);
-            nextp[2] = next[2]->GetReadPtr(plane);
-            npitch[2] = next[2]->GetPitch(plane);
+            pd.prevp[2] = prev[2]->GetReadPtr(plane);
+            pd.ppitch[2] = prev[2]->GetPitch(plane);
+            pd.nextp[2] = next[2]->GetReadPtr(plane);
+            pd.npitch[2] = next[2]->GetPitch(plane);
         case 2:
-            nextp[1] = next[1]->GetReadPtr(plane);
-            npitch[1] = next[1]->GetPitch(plane);
+            pd.nextp[1] = next[1]->GetReadPtr(plane);
+            pd.npitch[1] = next[1]->GetPitch(plane);
         default:
-            prevp[0] = prev[0]->GetReadPtr(plane);
-            ppitch[0] = prev[0]->GetPitch(plane);
-            prevp[1] = prev[1]->GetReadPtr(plane);
-            ppitch[1] = prev[1]->GetPitch(plane);
-            nextp[0] = next[0]->GetReadPtr(plane);
-            npitch[0] = next[0]->GetPitch(plane);
+            pd.prevp[0] = prev[0]->GetReadPtr(plane);
+            pd.ppitch[0] = prev[0]->GetPitch(plane);
+            pd.prevp[1] = prev[1]->GetReadPtr(plane);
+            pd.ppitch[1] = prev[1]->GetPitch(plane);
+            pd.nextp[0] = next[0]->GetReadPtr(plane);
+            pd.npitch[0] = next[0]->GetPitch(plane);
+        }
+
+        // a Crop without align=true returns views into its source frames.
+        bool aligned = is_aligned_plane(pd.currp, pd.cpitch, pd.width, align);
+        for (int i = 0; i < (strength > 2 ? 3 : 2); ++i) {
+            aligned = aligned
+                && is_aligned_plane(pd.prevp[i], pd.ppitch[i], pd.width, align);
+        }
+        for (int i = 0; i < strength; ++i) {
+            aligned = aligned
+                && is_aligned_plane(pd.nextp[i], pd.npitch[i], pd.width, align);
+        }
+        pd.proc = aligned ? mainProc : unalignedProc;
+        if (plane == PLANAR_A && !procAlpha) {
+            pd.proc = nullptr;
         }
 
-        mainProc(dstp, prevp, currp, nextp, dpitch, ppitch, cpitch, npitch,
-                 width, height);
+        // about two stripes per thread, so that a thread which finishes
+        // early can take another one.
+        const int rows = numThreads > 1
+            ? std::max((pd.height + numThreads * 2 - 1) / (numThreads * 2), 16)
+            : pd.height;
+        for (int y = 0; y < pd.height; y += rows) {
+            stripes.push_back({&pd, y, std::min(rows, pd.height - y)});
+        }
+    }
+
+    auto job = [&](size_t i) {
+        proc_stripe(*stripes[i].plane, stripes[i].y, stripes[i].rows, strength);
+    };
+    if (pool) {
+        pool->run(stripes.size(), job);
+    } else if (numThreads > 1) {
+        run_jobs(static_cast<IScriptEnvironment2*>(env), numThreads - 1,
+                 stripes.size(), job);
+    } else {
+        for (size_t i = 0; i < stripes.size(); ++i) {
+            job(i);
+        }
     }
-    
+
     return dst;
 }
 
 
 extern int has_sse2();
+extern int has_sse41();
 extern int has_avx2();
 
 static arch_t get_arch(int opt) noexcept
@@ -182,11 +510,14 @@ static arch_t get_arch(int opt) noexcept
     if (opt == NO_SIMD || !has_sse2()) {
         return NO_SIMD;
     }
+    if (opt == USE_SSE2 || !has_sse41()) {
+        return USE_SSE2;
+    }
 #if !defined(__AVX2__)
-    return USE_SSE2;
+    return USE_SSE41;
 #else
-    if (opt == USE_SSE2 || !has_avx2()) {
-        return USE_SSE2;
+    if (opt == USE_SSE41 || !has_avx2()) {
+        return USE_SSE41;
     }
     return USE_AVX2;
 #endif // __AVX2__
@@ -202,7 +533,9 @@ AVSValue __cdecl ReduceFlicker::create(AVSValue args, void*, ise_t* env)
     try {
         PClip clip = args[0].AsClip();
         const VideoInfo& vi = clip->GetVideoInfo();
-        validate(!vi.IsPlanar(), "input clip must be planar format.");
+        validate(!vi.IsPlanar() && !vi.IsYUY2() && !vi.IsRGB24()
+                 && !vi.IsRGB32(),
+                 "input clip must be planar, YUY2, RGB24 or RGB32.");
 
         int strength = args[1].AsInt(2);
         validate(strength < 1 || strength > 3,
@@ -214,11 +547,68 @@ AVSValue __cdecl ReduceFlicker::create(AVSValue args, void*, ise_t* env)
         bool is_avsplus = env->FunctionExists("SetFilterMTMode");
         arch_t arch = get_arch(args[4].AsInt(USE_AVX2));
         if (arch == USE_AVX2 && !is_avsplus) {
-            arch = USE_SSE2;
+            arch = USE_SSE41;
         }
 
+        // avs2.6 has only 8-bit formats, and no BitsPerComponent().
+        // the packed formats are processed as bytes.
+        int bits = is_avsplus && vi.IsPlanar() ? vi.BitsPerComponent() : 8;
+
+        // without raccess, the order is chosen by timing the first fetches.
         bool raccess = args[5].AsBool(true);
-        return new ReduceFlicker(clip, strength, aggressive, grey, arch, raccess);
+        bool autoorder = !args[5].Defined();
+
+        int threads = args[6].AsInt(1);
+        validate(threads < 0, "threads must be set to 0 or greater.");
+        if (threads == 0) {
+            threads = static_cast<int>(std::thread::hardware_concurrency());
+            threads = std::max(threads, 1);
+        }
+
+        int readahead = args[7].AsInt(0);
+        validate(readahead < 0 || readahead > 16,
+                 "readahead must be between 0 and 16.");
+
+        bool alpha = args[8].AsBool(false);
+
+        // prev1-prev3 and next1-next3. all or none of the ones strength uses.
+        PClip prev[3], next[3];
+        bool neighbors = false;
+        for (int i = 0; i < 6; ++i) {
+            neighbors = neighbors || args[9 + i].Defined();
+        }
+        if (neighbors) {
+            for (int i = 0; i < 3; ++i) {
+                validate(args[9 + i].Defined() != (i < (strength > 2 ? 3 : 2)),
+                         "prev1 and prev2 must be set, and prev3 only with "
+                         "strength=3.");
+                validate(args[12 + i].Defined() != (i < strength),
+                         "as many of next1-next3 as strength must be set.");
+            }
+            validate(readahead > 0,
+                     "prev/next and readahead cannot be used together.");
+            for (int i = 0; i < 6; ++i) {
+                if (!args[9 + i].Defined()) {
+                    continue;
+                }
+                PClip c = args[9 + i].AsClip();
+                const VideoInfo& cvi = c->GetVideoInfo();
+                validate(cvi.pixel_type != vi.pixel_type
+                         || cvi.width != vi.width || cvi.height != vi.height
+                         || cvi.num_frames != vi.num_frames,
+                         "prev and next must have the same format, "
+                         "dimensions and length as clip.");
+                if (i < 3) {
+                    prev[i] = c;
+                } else {
+                    next[i - 3] = c;
+                }
+            }
+        }
+
+        return new ReduceFlicker(clip, strength, aggressive, grey, alpha, arch,
+                                 bits, raccess, autoorder, threads, readahead,
+                                 prev, next, is_avsplus);
 
     } catch (const char* e) {
         env->ThrowError("ReduceFlicker: %s", e);
@@ -235,7 +625,8 @@ AvisynthPluginInit3(ise_t* env, const AVS_Linkage* const vectors)
 {
     AVS_linkage = vectors;
     env->AddFunction("ReduceFlicker",
-                     "c[strength]i[aggressive]b[grey]b[opt]i[raccess]b",
+                     "c[strength]i[aggressive]b[grey]b[opt]i[raccess]b[threads]i[readahead]i[alpha]b"
+                     "[prev1]c[prev2]c[prev3]c[next1]c[next2]c[next3]c",
                      ReduceFlicker::create, nullptr);
     if (env->FunctionExists("SetFilterMTMode")) {
         static_cast<IScriptEnvironment2*>(
@@ -13,12 +13,17 @@
 enum arch_t {
     NO_SIMD = 0,
     USE_SSE2 = 1,
-    USE_AVX2
+    USE_SSE41 = 2,
+    USE_AVX2 = 3
 };
 
 
 typedef IScriptEnvironment ise_t;
 
+class ThreadPool;
+class ReadAhead;
+class FetchOrder;
+
 
 typedef void(__stdcall *proc_filter_t)(
     uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
@@ -28,15 +33,31 @@ typedef void(__stdcall *proc_filter_t)(
 
 class ReduceFlicker : public GenericVideoFilter {
     int numPlanes;
+    // YUVA and RGBA on avs+. the alpha plane is processed or copied.
+    bool hasAlpha;
+    bool procAlpha;
     const int strength;
     size_t align;
-    bool raccess;
+    FetchOrder* fetchOrder;
+    int numThreads;
+    // nullptr unless threads > 1 on avs2.6; avs+ runs the stripes as jobs.
+    ThreadPool* pool;
+    ReadAhead* readAhead;
 
     proc_filter_t mainProc;
+    // for planes of source frames which are not aligned.
+    proc_filter_t unalignedProc;
+
+    // prev1-3/next1-3 in the order of the window (prev3 first), or empty.
+    // frame n of these is used instead of child at n + i - 3.
+    PClip neighbors[7];
 
 public:
-    ReduceFlicker(PClip c, int str, bool agr, bool grey, arch_t arch, bool raccess);
-    ~ReduceFlicker() {}
+    ReduceFlicker(PClip c, int str, bool agr, bool grey, bool alpha,
+                  arch_t arch, int bits, bool raccess, bool autoorder,
+                  int threads, int readahead, const PClip* prev,
+                  const PClip* next, bool avsplus);
+    ~ReduceFlicker();
     PVideoFrame __stdcall GetFrame(int n, ise_t* env);
     static AVSValue __cdecl create(AVSValue args, void*, ise_t* env);
 };
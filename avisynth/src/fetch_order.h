@@ -0,0 +1,86 @@
+/*
+fetch_order.h
+
+This file is a part of ReduceFlicker.
+
+Copyright (C) 2016 OKA Motofumi
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+#ifndef REDUCE_FLICKER_FETCH_ORDER_H
+#define REDUCE_FLICKER_FETCH_ORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+
+// the order in which the source frames of a window are requested.
+enum fetch_order_t {
+    ORDER_ASCENDING,
+    ORDER_DESCENDING,
+};
+
+
+/*
+ * Chooses the fetch order of one filter instance from the time the source
+ * takes to deliver a window. A source which decodes linearly (long GOP) has
+ * to seek back and decode again from a keyframe for each frame requested
+ * before the one it just decoded, so one order can cost a multiple of the
+ * other. Which one depends on the source and on its cache, so it is measured.
+ *
+ * After the first window, which also pays for opening the source, the next
+ * NUM_PROBES windows are fetched in four phases: preferred, other, other,
+ * preferred. The symmetry cancels a trend of the source, such as its queue
+ * filling up while the first frames are rendered in parallel. A window
+ * which was in flight together with one of the other order is not counted.
+ * Then the order whose median time is lower by more than 10% is used for the
+ * rest of the clip. If neither is, or fewer than three windows of an order
+ * were counted, the preferred one is.
+ */
+class FetchOrder {
+public:
+    static constexpr int NUM_PROBES = 32;
+
+private:
+    std::mutex mtx;
+    // the order chosen, or -1 while probing.
+    std::atomic<int> chosen;
+    const fetch_order_t preferred;
+    int started;
+    int finished;
+    int inFlight[2]; // probes begun and not finished, by order.
+    uint64_t startNs[NUM_PROBES];
+    uint64_t ns[NUM_PROBES]; // 0 for a window which is not counted.
+    bool mixed[NUM_PROBES];
+
+    fetch_order_t probeOrder(int probe) const;
+    void finish(int probe, uint64_t now);
+
+public:
+    // with adaptive false, preferred is always used.
+    FetchOrder(fetch_order_t preferred, bool adaptive);
+    // the order of the next window. probe is set to a non-zero value to be
+    // passed to end() (or cancel()) if the window is timed.
+    fetch_order_t begin(int& probe);
+    // called once all the frames of the window have been received.
+    void end(int probe);
+    // called instead of end() if the window could not be fetched.
+    void cancel(int probe);
+};
+
+#endif
@@ -25,23 +25,52 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
 #include "ReduceFlicker.h"
 
 
-static inline int abs_diff(int x, int y)
+template <typename T>
+static inline T abs_diff(T x, T y)
 {
     return x < y ? y - x : x - y;
 }
 
-static inline int average(int x, int y)
+template <typename T>
+static inline T clamp(T x, T minimum, T maximum)
 {
-    return (x + y + 1) / 2;
+    return std::min(std::max(x, minimum), maximum);
 }
 
-static inline int clamp(int x, int minimum, int maximum)
+template <typename T>
+static inline T get_avg(T a, T b, T x)
 {
-    return std::min(std::max(x, minimum), maximum);
+    T avg = std::max((a + b + 1) / 2 - 1, 0);
+    return (avg + x + 1) / 2;
+}
+
+template <>
+inline float get_avg(float a, float b, float x)
+{
+    return (a + b + (x + x)) * 0.25f;
 }
 
 
-template <int STRENGTH>
+/*
+ * Packed formats are processed as one plane of bytes. KEEP selects the bytes
+ * of each 4 byte group which are copied from curr instead of being filtered,
+ * for the channels which are not processed. 0 for none.
+ */
+constexpr uint32_t KEEP_ALPHA = 0xFF000000;  // A of BGRA
+constexpr uint32_t KEEP_CHROMA = 0xFF00FF00; // U and V of YUYV
+
+template <uint32_t KEEP>
+static inline bool is_kept(int x)
+{
+    return KEEP != 0 && (KEEP >> (x % 4 * 8) & 0xFF) != 0;
+}
+
+
+/*
+ * T0 is the sample type and T1 the type the samples are computed in.
+ * width and the pitches are in bytes, as AviSynth gives them.
+ */
+template <typename T0, typename T1, int STRENGTH, uint32_t KEEP = 0>
 static void __stdcall
 proc_c(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
        const uint8_t** nextp, const int dpitch, const int* ppitch,
@@ -51,54 +80,61 @@ proc_c(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
     using std::min;
     using std::max;
 
-    const uint8_t *prv0, *prv1, *prv2, *nxt0, *nxt1, *nxt2;
-    prv0 = prevp[0];
-    prv1 = prevp[1];
-    nxt0 = nextp[0];
+    constexpr int size = sizeof(T0);
+
+    const T0 *prv0, *prv1, *prv2, *nxt0, *nxt1, *nxt2;
+    prv0 = reinterpret_cast<const T0*>(prevp[0]);
+    prv1 = reinterpret_cast<const T0*>(prevp[1]);
+    nxt0 = reinterpret_cast<const T0*>(nextp[0]);
     if (STRENGTH > 1) {
-        nxt1 = nextp[1];
+        nxt1 = reinterpret_cast<const T0*>(nextp[1]);
     }
     if (STRENGTH > 2) {
-        prv2 = prevp[2];
-        nxt2 = nextp[2];
+        prv2 = reinterpret_cast<const T0*>(prevp[2]);
+        nxt2 = reinterpret_cast<const T0*>(nextp[2]);
     }
+    const T0* cur0 = reinterpret_cast<const T0*>(currp);
+    T0* dst0 = reinterpret_cast<T0*>(dstp);
 
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            const int currx = static_cast<int>(currp[x]);
-            int d  = abs_diff(currx, prv1[x]);
+        for (int x = 0; x < width / size; ++x) {
+            const T1 currx = static_cast<T1>(cur0[x]);
+            T1 d  = abs_diff<T1>(currx, prv1[x]);
             if (STRENGTH > 1) {
-                d = min(d, abs_diff(currx, nxt1[x]));
+                d = min(d, abs_diff<T1>(currx, nxt1[x]));
             }
             if (STRENGTH > 2) {
-                d = min(d, abs_diff(currx, prv2[x]));
-                d = min(d, abs_diff(currx, nxt2[x]));
+                d = min(d, abs_diff<T1>(currx, prv2[x]));
+                d = min(d, abs_diff<T1>(currx, nxt2[x]));
             }
-            int avg = max(average(prv0[x], nxt0[x]) - 1, 0);
-            avg = average(avg, currx);
-            int ul = max(min(prv0[x], nxt0[x]) - d, currx);
-            int ll = min(max(prv0[x], nxt0[x]) + d, currx);
-            dstp[x] = clamp(avg, ll, ul);
+            const T1 prvx = static_cast<T1>(prv0[x]);
+            const T1 nxtx = static_cast<T1>(nxt0[x]);
+            T1 avg = get_avg(prvx, nxtx, currx);
+            T1 ul = max(min(prvx, nxtx) - d, currx);
+            T1 ll = min(max(prvx, nxtx) + d, currx);
+            dst0[x] = is_kept<KEEP>(x) ? cur0[x]
+                                       : static_cast<T0>(clamp(avg, ll, ul));
         }
-        prv0 += ppitch[0];
-        prv1 += ppitch[1];
-        nxt0 += npitch[0];
-        currp += cpitch;
-        dstp += dpitch;
+        prv0 += ppitch[0] / size;
+        prv1 += ppitch[1] / size;
+        nxt0 += npitch[0] / size;
+        cur0 += cpitch / size;
+        dst0 += dpitch / size;
         if (STRENGTH > 1) {
-            nxt1 += npitch[1];
+            nxt1 += npitch[1] / size;
         }
         if (STRENGTH > 2) {
-            prv2 += ppitch[2];
-            nxt2 += npitch[2];
+            prv2 += ppitch[2] / size;
+            nxt2 += npitch[2] / size;
         }
     }
 }
 
 
-static inline void update_diff(int x, int y, int& d1, int& d2)
+template <typename T>
+static inline void update_diff(T x, T y, T& d1, T& d2)
 {
-    int d = x - y;
+    T d = x - y;
     if (d >= 0) {
         d2 = 0;
         d1 = std::min(d, d1);
@@ -109,7 +145,7 @@ static inline void update_diff(int x, int y, int& d1, int& d2)
 }
 
 
-template <int STRENGTH>
+template <typename T0, typename T1, int STRENGTH, uint32_t KEEP = 0>
 static void __stdcall
 proc_a_c(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
          const uint8_t** nextp, const int dpitch, const int* ppitch,
@@ -119,52 +155,58 @@ proc_a_c(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
     using std::min;
     using std::max;
 
-    const uint8_t *prv0, *prv1, *prv2, *nxt0, *nxt1, *nxt2;
-    prv0 = prevp[0];
-    prv1 = prevp[1];
-    nxt0 = nextp[0];
+    constexpr int size = sizeof(T0);
+
+    const T0 *prv0, *prv1, *prv2, *nxt0, *nxt1, *nxt2;
+    prv0 = reinterpret_cast<const T0*>(prevp[0]);
+    prv1 = reinterpret_cast<const T0*>(prevp[1]);
+    nxt0 = reinterpret_cast<const T0*>(nextp[0]);
     if (STRENGTH > 1) {
-        nxt1 = nextp[1];
+        nxt1 = reinterpret_cast<const T0*>(nextp[1]);
     }
     if (STRENGTH > 2) {
-        prv2 = prevp[2];
-        nxt2 = nextp[2];
+        prv2 = reinterpret_cast<const T0*>(prevp[2]);
+        nxt2 = reinterpret_cast<const T0*>(nextp[2]);
     }
+    const T0* cur0 = reinterpret_cast<const T0*>(currp);
+    T0* dst0 = reinterpret_cast<T0*>(dstp);
 
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            const int currx = static_cast<int>(currp[x]);
-            int d1 = prv1[x] - currx;
-            int d2 = 0;
+        for (int x = 0; x < width / size; ++x) {
+            const T1 currx = static_cast<T1>(cur0[x]);
+            T1 d1 = prv1[x] - currx;
+            T1 d2 = 0;
             if (d1 < 0) {
                 d2 = -d1;
                 d1 = 0;
             }
             if (STRENGTH > 1) {
-                update_diff(nxt1[x], currx, d1, d2);
+                update_diff<T1>(nxt1[x], currx, d1, d2);
             }
             if (STRENGTH > 2) {
-                update_diff(prv2[x], currx, d1, d2);
-                update_diff(nxt2[x], currx, d1, d2);
+                update_diff<T1>(prv2[x], currx, d1, d2);
+                update_diff<T1>(nxt2[x], currx, d1, d2);
             }
 
-            int avg = max(average(prv0[x], nxt0[x]) - 1, 0);
-            avg = average(avg, currx);
-            int ul = max(min(prv0[x], nxt0[x]) - d1, currx);
-            int ll = min(max(prv0[x], nxt0[x]) + d2, currx);
-            dstp[x] = clamp(avg, ll, ul);
+            const T1 prvx = static_cast<T1>(prv0[x]);
+            const T1 nxtx = static_cast<T1>(nxt0[x]);
+            T1 avg = get_avg(prvx, nxtx, currx);
+            T1 ul = max(min(prvx, nxtx) - d1, currx);
+            T1 ll = min(max(prvx, nxtx) + d2, currx);
+            dst0[x] = is_kept<KEEP>(x) ? cur0[x]
+                                       : static_cast<T0>(clamp(avg, ll, ul));
         }
-        prv0 += ppitch[0];
-        prv1 += ppitch[1];
-        nxt0 += npitch[0];
-        currp += cpitch;
-        dstp += dpitch;
+        prv0 += ppitch[0] / size;
+        prv1 += ppitch[1] / size;
+        nxt0 += npitch[0] / size;
+        cur0 += cpitch / size;
+        dst0 += dpitch / size;
         if (STRENGTH > 1) {
-            nxt1 += npitch[1];
+            nxt1 += npitch[1] / size;
         }
         if (STRENGTH > 2) {
-            prv2 += ppitch[2];
-            nxt2 += npitch[2];
+            prv2 += ppitch[2] / size;
+            nxt2 += npitch[2] / size;
         }
     }
 }
@@ -175,7 +217,27 @@ proc_a_c(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
 #include "simd.h"
 
 
-template <typename T, int STRENGTH>
+/*
+ * The source frames may be views into other frames (Crop without
+ * align=true), which start anywhere and are not followed by any padding.
+ * With ALIGNED = false they are read with unaligned loads, and never past
+ * width. dst is always a new frame, so it is aligned either way.
+ */
+template <typename V, bool ALIGNED>
+SFINLINE V read(const uint8_t* p, int rem)
+{
+    if (ALIGNED) {
+        return load<V>(p);
+    }
+    if (rem >= static_cast<int>(sizeof(V))) {
+        return loadu<V>(p);
+    }
+    return load_tail<V>(p, rem);
+}
+
+
+template <typename T, typename V, int STRENGTH, arch_t ARCH, bool ALIGNED,
+          uint32_t KEEP = 0>
 static void __stdcall
 proc_simd(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
           const uint8_t** nextp, const int dpitch, const int* ppitch,
@@ -194,25 +256,28 @@ proc_simd(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
         nxt2 = nextp[2];
     }
 
-    const T one = set1<T>(1);
+    const V q = set1<T, V>();
+    const V keep = set_mask<V>(KEEP);
 
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += sizeof(T)) {
-            const T currx = load<T>(currp + x);
-            T d = absdiff(currx, load<T>(prv1 + x));
+        for (int x = 0; x < width; x += sizeof(V)) {
+            const int rem = width - x;
+            const V currx = read<V, ALIGNED>(currp + x, rem);
+            V d = absdiff<T, V>(currx, read<V, ALIGNED>(prv1 + x, rem));
             if (STRENGTH > 1) {
-                d = min(d, absdiff<T>(currx, load<T>(nxt1 + x)));
+                d = min<T, ARCH>(d, absdiff<T, V>(currx, read<V, ALIGNED>(nxt1 + x, rem)));
             }
             if (STRENGTH > 2) {
-                d = min(d, absdiff(currx, load<T>(prv2 + x)));
-                d = min(d, absdiff(currx, load<T>(nxt2 + x)));
+                d = min<T, ARCH>(d, absdiff<T, V>(currx, read<V, ALIGNED>(prv2 + x, rem)));
+                d = min<T, ARCH>(d, absdiff<T, V>(currx, read<V, ALIGNED>(nxt2 + x, rem)));
             }
-            const T pr0 = load<T>(prv0 + x);
-            const T nx0 = load<T>(nxt0 + x);
-            const T ul = max(subs(min(pr0, nx0), d), currx);
-            const T ll = min(adds(max(pr0, nx0), d), currx);
-            const T avg = average(subs(average(pr0, nx0), one), currx);
-            stream(dstp + x, clamp(avg, ll, ul));
+            const V pr0 = read<V, ALIGNED>(prv0 + x, rem);
+            const V nx0 = read<V, ALIGNED>(nxt0 + x, rem);
+            const V ul = max<T, ARCH>(subs<T>(min<T, ARCH>(pr0, nx0), d), currx);
+            const V ll = min<T, ARCH>(adds<T>(max<T, ARCH>(pr0, nx0), d), currx);
+            const V avg = get_avg<T, V>(pr0, nx0, currx, q);
+            const V res = clamp<T, ARCH>(avg, ll, ul);
+            stream(dstp + x, KEEP != 0 ? blendv<ARCH>(res, currx, keep) : res);
         }
         prv0 += ppitch[0];
         prv1 += ppitch[1];
@@ -230,18 +295,19 @@ proc_simd(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
 }
 
 
-template <typename T>
-SFINLINE void update_diff(const T& x, const T& y, T& d1, T& d2, const T& zero)
+template <typename T, typename V, arch_t ARCH>
+SFINLINE void update_diff(const V& x, const V& y, V& d1, V& d2, const V& zero)
 {
-    const T maxxy = max(x, y);
-    const T mask = cmpeq(x, maxxy);
-    const T d = subs(maxxy, min(x, y));
-    d1 = blendv(zero, min(d, d1), mask);
-    d2 = blendv(min(d, d2), zero, mask);
+    const V maxxy = max<T, ARCH>(x, y);
+    const V mask = cmpeq<T>(x, maxxy);
+    const V d = subs<T>(maxxy, min<T, ARCH>(x, y));
+    d1 = blendv<ARCH>(zero, min<T, ARCH>(d, d1), mask);
+    d2 = blendv<ARCH>(min<T, ARCH>(d, d2), zero, mask);
 }
 
 
-template <typename T, int STRENGTH>
+template <typename T, typename V, int STRENGTH, arch_t ARCH, bool ALIGNED,
+          uint32_t KEEP = 0>
 static void __stdcall
 proc_a_simd(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
             const uint8_t** nextp, const int dpitch, const int* ppitch,
@@ -260,32 +326,35 @@ proc_a_simd(uint8_t* dstp, const uint8_t** prevp, const uint8_t* currp,
         nxt2 = nextp[2];
     }
 
-    const T one = set1<T>(1);
-    const T zero = xor_reg(one, one);
+    const V q = set1<T, V>();
+    const V keep = set_mask<V>(KEEP);
+    const V zero = setzero<V>();
 
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += sizeof(T)) {
-            const T currx = load<T>(currp + x);
-            T t0 = load<T>(prv1 + x);
-            T t1 = max(t0, currx);
-            T t2 = cmpeq(t0, t1);
-            t0 = subs(t1, min(t0, currx));
-            T d1 = and_reg(t2, t0);
-            T d2 = andnot_reg(t2, t0);
+        for (int x = 0; x < width; x += sizeof(V)) {
+            const int rem = width - x;
+            const V currx = read<V, ALIGNED>(currp + x, rem);
+            V t0 = read<V, ALIGNED>(prv1 + x, rem);
+            V t1 = max<T, ARCH>(t0, currx);
+            V t2 = cmpeq<T>(t0, t1);
+            t0 = subs<T>(t1, min<T, ARCH>(t0, currx));
+            V d1 = and_reg(t2, t0);
+            V d2 = andnot_reg(t2, t0);
             if (STRENGTH > 1) {
-                update_diff(load<T>(nxt1 + x), currx, d1, d2, zero);
+                update_diff<T, V, ARCH>(read<V, ALIGNED>(nxt1 + x, rem), currx, d1, d2, zero);
             }
             if (STRENGTH > 2) {
-                update_diff(load<T>(prv2 + x), currx, d1, d2, zero);
-                update_diff(load<T>(nxt2 + x), currx, d1, d2, zero);
+                update_diff<T, V, ARCH>(read<V, ALIGNED>(prv2 + x, rem), currx, d1, d2, zero);
+                update_diff<T, V, ARCH>(read<V, ALIGNED>(nxt2 + x, rem), currx, d1, d2, zero);
             }
 
-            const T pr0 = load<T>(prv0 + x);
-            const T nx0 = load<T>(nxt0 + x);
-            const T ul = max(subs(min(pr0, nx0), d1), currx);
-            const T ll = min(adds(max(pr0, nx0), d2), currx);
-            const T avg = average(subs(average(pr0, nx0), one), currx);
-            stream(dstp + x, clamp(avg, ll, ul));
+            const V pr0 = read<V, ALIGNED>(prv0 + x, rem);
+            const V nx0 = read<V, ALIGNED>(nxt0 + x, rem);
+            const V ul = max<T, ARCH>(subs<T>(min<T, ARCH>(pr0, nx0), d1), currx);
+            const V ll = min<T, ARCH>(adds<T>(max<T, ARCH>(pr0, nx0), d2), currx);
+            const V avg = get_avg<T, V>(pr0, nx0, currx, q);
+            const V res = clamp<T, ARCH>(avg, ll, ul);
+            stream(dstp + x, KEEP != 0 ? blendv<ARCH>(res, currx, keep) : res);
         }
         prv0 += ppitch[0];
         prv1 += ppitch[1];
@@ -0,0 +1,134 @@
+/*
+readahead.cpp
+
+This file is a part of ReduceFlicker.
+
+Copyright (C) 2016 OKA Motofumi
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+#include <algorithm>
+
+#include "readahead.h"
+
+
+ReadAhead::ReadAhead(PClip c, int num_frames, int d) :
+    child(c), numFrames(num_frames), depth(d), busy(-1), quit(false),
+    lastN(-2), streak(0)
+{}
+
+
+ReadAhead::~ReadAhead()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        quit = true;
+    }
+    cond.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+
+PVideoFrame ReadAhead::fetch(int n, ise_t* env)
+{
+    std::lock_guard<std::mutex> lock(upstream);
+    return child->GetFrame(n, env);
+}
+
+
+void ReadAhead::run(ise_t* env)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cond.wait(lock, [this] { return quit || !queue.empty(); });
+        if (quit) {
+            return;
+        }
+        const int n = queue.front();
+        queue.pop_front();
+        busy = n;
+        lock.unlock();
+
+        PVideoFrame frame;
+        try {
+            frame = fetch(n, env);
+        } catch (...) {
+        }
+
+        lock.lock();
+        ready[n] = frame;
+        busy = -1;
+        cond.notify_all();
+    }
+}
+
+
+PVideoFrame ReadAhead::getFrame(int n, ise_t* env)
+{
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        // not started yet. it is fetched here instead.
+        auto q = std::find(queue.begin(), queue.end(), n);
+        if (q != queue.end()) {
+            queue.erase(q);
+        }
+        cond.wait(lock, [&] { return busy != n; });
+        auto it = ready.find(n);
+        if (it != ready.end()) {
+            PVideoFrame frame = it->second;
+            ready.erase(it);
+            if (frame) {
+                return frame;
+            }
+        }
+    }
+    return fetch(n, env);
+}
+
+
+void ReadAhead::schedule(int n, int last, ise_t* env)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        streak = n == lastN + 1 ? streak + 1 : 0;
+        lastN = n;
+
+        // after a seek, the frames ahead of the old position are not used.
+        auto stale = [&](int i) { return i <= last || i > last + depth; };
+        queue.erase(std::remove_if(queue.begin(), queue.end(), stale),
+                    queue.end());
+        for (auto it = ready.begin(); it != ready.end();) {
+            it = stale(it->first) ? ready.erase(it) : std::next(it);
+        }
+        if (streak == 0) {
+            return;
+        }
+        const int end = std::min(last + depth, numFrames - 1);
+        for (int i = last + 1; i <= end; ++i) {
+            if (i != busy && ready.count(i) == 0
+                    && std::find(queue.begin(), queue.end(), i) == queue.end()) {
+                queue.push_back(i);
+            }
+        }
+        if (!worker.joinable()) {
+            worker = std::thread(&ReadAhead::run, this, env);
+        }
+    }
+    cond.notify_all();
+}
@@ -0,0 +1,76 @@
+/*
+readahead.h
+
+This file is a part of ReduceFlicker.
+
+Copyright (C) 2016 OKA Motofumi
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+#ifndef REDUCE_FLICKER_READAHEAD_H
+#define REDUCE_FLICKER_READAHEAD_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "ReduceFlicker.h"
+
+
+/*
+ * Fetches the source frames after the window of the current frame in the
+ * background while it is filtered, once frames are requested in order.
+ * At most depth frames are queued or kept ahead.
+ * The fetches run one after another on a thread of their own, on avs2.6 and
+ * avs+ alike. They are not jobs of the avs+ thread pool: a job waiting for
+ * upstream would hold a worker, which the filters upstream (or the stripes
+ * of threads>1) may need to make progress.
+ * All the child->GetFrame() calls of the filter go through one lock, so
+ * upstream is never entered by two of them at once.
+ */
+class ReadAhead {
+    PClip child;
+    const int numFrames;
+    const int depth;
+
+    std::mutex upstream;
+    std::mutex mtx; // guards the members below.
+    std::condition_variable cond;
+    std::deque<int> queue;
+    // fetched frames. empty if the fetch failed; getFrame() then fetches n
+    // again, so that the error is reported by the thread which needs it.
+    std::map<int, PVideoFrame> ready;
+    int busy; // the frame the worker is fetching, or -1.
+    bool quit;
+    int lastN;
+    int streak;
+    std::thread worker;
+
+    PVideoFrame fetch(int n, ise_t* env);
+    void run(ise_t* env);
+
+public:
+    ReadAhead(PClip child, int num_frames, int depth);
+    ~ReadAhead();
+    // frame n, from the background fetch if one was done or started for it.
+    PVideoFrame getFrame(int n, ise_t* env);
+    // queues the fetches after last, the last frame GetFrame(n) reads.
+    void schedule(int n, int last, ise_t* env);
+};
+
+#endif
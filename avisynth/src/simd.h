@@ -25,32 +25,62 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
 #define REDUCE_FLICKER_SIMD_H
 
 #include <cstdint>
+#include <cstring>
 
 #if defined(__AVX2__)
 #include <immintrin.h>
 #else
-#include <emmintrin.h>
+#include <smmintrin.h>
 #endif
 
+#include "ReduceFlicker.h"
+
 #define SFINLINE static __forceinline
 
 
+/*
+ * T is the sample type (uint8_t, int16_t for up to 10 bits with SSE2,
+ * uint16_t or float) and V the vector type. Integer samples use __m128i and
+ * __m256i, float samples __m128 and __m256.
+ * ARCH selects between the SSE2 and SSE4.1 instructions for the operations
+ * which have both (16-bit min/max and blendv).
+ */
+
+template <typename V> V load(const uint8_t* p);
+
+template <typename V> V loadu(const uint8_t* p);
+
+template <typename V> V setzero();
 
-template <typename T> T set1(int8_t x);
+// 1 for integer samples, 0.25 for float (see get_avg).
+template <typename T, typename V> V set1();
 
-template <typename T> T load(const uint8_t* p);
+// m in every 32 bits, see KEEP in proc_filter.h.
+template <typename V> V set_mask(uint32_t m);
 
 
 template <>
-SFINLINE __m128i set1<__m128i>(int8_t x)
+SFINLINE __m128i load<__m128i>(const uint8_t* p)
 {
-    return _mm_set1_epi8(x);
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(p));
 }
 
 template <>
-SFINLINE __m128i load<__m128i>(const uint8_t* p)
+SFINLINE __m128 load<__m128>(const uint8_t* p)
 {
-    return _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm_load_ps(reinterpret_cast<const float*>(p));
+}
+
+template <>
+SFINLINE __m128i loadu<__m128i>(const uint8_t* p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+template <>
+SFINLINE __m128 loadu<__m128>(const uint8_t* p)
+{
+    return _mm_loadu_ps(reinterpret_cast<const float*>(p));
 }
 
 SFINLINE void stream(uint8_t* p, const __m128i& x)
@@ -58,14 +88,57 @@ SFINLINE void stream(uint8_t* p, const __m128i& x)
     _mm_stream_si128(reinterpret_cast<__m128i*>(p), x);
 }
 
-SFINLINE __m128i adds(const __m128i& x, const __m128i& y)
+SFINLINE void stream(uint8_t* p, const __m128& x)
 {
-    return _mm_adds_epu8(x, y);
+    _mm_stream_ps(reinterpret_cast<float*>(p), x);
 }
 
-SFINLINE __m128i subs(const __m128i& x, const __m128i& y)
+template <>
+SFINLINE __m128i setzero<__m128i>()
 {
-    return _mm_subs_epu8(x, y);
+    return _mm_setzero_si128();
+}
+
+template <>
+SFINLINE __m128 setzero<__m128>()
+{
+    return _mm_setzero_ps();
+}
+
+template <>
+SFINLINE __m128i set1<uint8_t, __m128i>()
+{
+    return _mm_set1_epi8(1);
+}
+
+template <>
+SFINLINE __m128i set_mask<__m128i>(uint32_t m)
+{
+    return _mm_set1_epi32(static_cast<int>(m));
+}
+
+template <>
+SFINLINE __m128 set_mask<__m128>(uint32_t m)
+{
+    return _mm_castsi128_ps(set_mask<__m128i>(m));
+}
+
+template <>
+SFINLINE __m128i set1<int16_t, __m128i>()
+{
+    return _mm_set1_epi16(1);
+}
+
+template <>
+SFINLINE __m128i set1<uint16_t, __m128i>()
+{
+    return _mm_set1_epi16(1);
+}
+
+template <>
+SFINLINE __m128 set1<float, __m128>()
+{
+    return _mm_set1_ps(0.25f);
 }
 
 SFINLINE __m128i or_reg(const __m128i& x, const __m128i& y)
@@ -73,74 +146,274 @@ SFINLINE __m128i or_reg(const __m128i& x, const __m128i& y)
     return _mm_or_si128(x, y);
 }
 
+SFINLINE __m128 or_reg(const __m128& x, const __m128& y)
+{
+    return _mm_or_ps(x, y);
+}
+
 SFINLINE __m128i and_reg(const __m128i& x, const __m128i& y)
 {
     return _mm_and_si128(x, y);
 }
 
+SFINLINE __m128 and_reg(const __m128& x, const __m128& y)
+{
+    return _mm_and_ps(x, y);
+}
+
 SFINLINE __m128i andnot_reg(const __m128i& x, const __m128i& y)
 {
     return _mm_andnot_si128(x, y);
 }
 
-SFINLINE __m128i xor_reg(const __m128i& x, const __m128i& y)
+SFINLINE __m128 andnot_reg(const __m128& x, const __m128& y)
 {
-    return _mm_xor_si128(x, y);
+    return _mm_andnot_ps(x, y);
 }
 
+
+template <typename T>
+SFINLINE __m128i adds(const __m128i& x, const __m128i& y)
+{
+    return _mm_adds_epu16(x, y);
+}
+
+template <>
+SFINLINE __m128i adds<uint8_t>(const __m128i& x, const __m128i& y)
+{
+    return _mm_adds_epu8(x, y);
+}
+
+template <typename T>
+SFINLINE __m128 adds(const __m128& x, const __m128& y)
+{
+    return _mm_add_ps(x, y);
+}
+
+template <typename T>
+SFINLINE __m128i subs(const __m128i& x, const __m128i& y)
+{
+    return _mm_subs_epu16(x, y);
+}
+
+template <>
+SFINLINE __m128i subs<uint8_t>(const __m128i& x, const __m128i& y)
+{
+    return _mm_subs_epu8(x, y);
+}
+
+template <typename T>
+SFINLINE __m128 subs(const __m128& x, const __m128& y)
+{
+    return _mm_sub_ps(x, y);
+}
+
+template <typename T>
 SFINLINE __m128i cmpeq(const __m128i& x, const __m128i& y)
+{
+    return _mm_cmpeq_epi16(x, y);
+}
+
+template <>
+SFINLINE __m128i cmpeq<uint8_t>(const __m128i& x, const __m128i& y)
 {
     return _mm_cmpeq_epi8(x, y);
 }
 
+template <typename T>
+SFINLINE __m128 cmpeq(const __m128& x, const __m128& y)
+{
+    return _mm_cmpeq_ps(x, y);
+}
+
+template <typename T>
+SFINLINE __m128i average(const __m128i& x, const __m128i& y)
+{
+    return _mm_avg_epu16(x, y);
+}
+
+template <>
+SFINLINE __m128i average<uint8_t>(const __m128i& x, const __m128i& y)
+{
+    return _mm_avg_epu8(x, y);
+}
+
+
+// SSE2 has no unsigned 16-bit min/max, so they are made of saturated subs.
+template <typename T, arch_t ARCH>
 SFINLINE __m128i min(const __m128i& x, const __m128i& y)
+{
+    return _mm_subs_epu16(x, _mm_subs_epu16(x, y));
+}
+
+template <>
+SFINLINE __m128i min<uint8_t, USE_SSE2>(const __m128i& x, const __m128i& y)
 {
     return _mm_min_epu8(x, y);
 }
 
+template <>
+SFINLINE __m128i min<int16_t, USE_SSE2>(const __m128i& x, const __m128i& y)
+{
+    return _mm_min_epi16(x, y);
+}
+
+template <>
+SFINLINE __m128i min<uint8_t, USE_SSE41>(const __m128i& x, const __m128i& y)
+{
+    return _mm_min_epu8(x, y);
+}
+
+template <>
+SFINLINE __m128i min<uint16_t, USE_SSE41>(const __m128i& x, const __m128i& y)
+{
+    return _mm_min_epu16(x, y);
+}
+
+template <typename T, arch_t ARCH>
+SFINLINE __m128 min(const __m128& x, const __m128& y)
+{
+    return _mm_min_ps(x, y);
+}
+
+template <typename T, arch_t ARCH>
 SFINLINE __m128i max(const __m128i& x, const __m128i& y)
+{
+    return _mm_adds_epu16(y, _mm_subs_epu16(x, y));
+}
+
+template <>
+SFINLINE __m128i max<uint8_t, USE_SSE2>(const __m128i& x, const __m128i& y)
 {
     return _mm_max_epu8(x, y);
 }
 
-SFINLINE __m128i average(const __m128i& x, const __m128i& y)
+template <>
+SFINLINE __m128i max<int16_t, USE_SSE2>(const __m128i& x, const __m128i& y)
 {
-    return _mm_avg_epu8(x, y);
+    return _mm_max_epi16(x, y);
+}
+
+template <>
+SFINLINE __m128i max<uint8_t, USE_SSE41>(const __m128i& x, const __m128i& y)
+{
+    return _mm_max_epu8(x, y);
+}
+
+template <>
+SFINLINE __m128i max<uint16_t, USE_SSE41>(const __m128i& x, const __m128i& y)
+{
+    return _mm_max_epu16(x, y);
 }
 
+template <typename T, arch_t ARCH>
+SFINLINE __m128 max(const __m128& x, const __m128& y)
+{
+    return _mm_max_ps(x, y);
+}
+
+template <arch_t ARCH>
 SFINLINE __m128i blendv(const __m128i& x, const __m128i& y, const __m128i& m)
 {
     return or_reg(and_reg(m, y), andnot_reg(m, x));
 }
 
+template <>
+SFINLINE __m128i
+blendv<USE_SSE41>(const __m128i& x, const __m128i& y, const __m128i& m)
+{
+    return _mm_blendv_epi8(x, y, m);
+}
 
-#if defined(__AVX2__)
+template <arch_t ARCH>
+SFINLINE __m128 blendv(const __m128& x, const __m128& y, const __m128& m)
+{
+    return or_reg(and_reg(m, y), andnot_reg(m, x));
+}
 
 template <>
-SFINLINE __m256i set1<__m256i>(int8_t x)
+SFINLINE __m128 blendv<USE_SSE41>(const __m128& x, const __m128& y, const __m128& m)
 {
-    return _mm256_set1_epi8(x);
+    return _mm_blendv_ps(x, y, m);
 }
 
+
+#if defined(__AVX2__)
+
 template <>
 SFINLINE __m256i load<__m256i>(const uint8_t* p)
 {
     return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
 }
 
+template <>
+SFINLINE __m256 load<__m256>(const uint8_t* p)
+{
+    return _mm256_load_ps(reinterpret_cast<const float*>(p));
+}
+
+template <>
+SFINLINE __m256i loadu<__m256i>(const uint8_t* p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+template <>
+SFINLINE __m256 loadu<__m256>(const uint8_t* p)
+{
+    return _mm256_loadu_ps(reinterpret_cast<const float*>(p));
+}
+
 SFINLINE void stream(uint8_t* p, const __m256i& x)
 {
     _mm256_stream_si256(reinterpret_cast<__m256i*>(p), x);
 }
 
-SFINLINE __m256i adds(const __m256i& x, const __m256i& y)
+SFINLINE void stream(uint8_t* p, const __m256& x)
 {
-    return _mm256_adds_epu8(x, y);
+    _mm256_stream_ps(reinterpret_cast<float*>(p), x);
 }
 
-SFINLINE __m256i subs(const __m256i& x, const __m256i& y)
+template <>
+SFINLINE __m256i setzero<__m256i>()
 {
-    return _mm256_subs_epu8(x, y);
+    return _mm256_setzero_si256();
+}
+
+template <>
+SFINLINE __m256 setzero<__m256>()
+{
+    return _mm256_setzero_ps();
+}
+
+template <>
+SFINLINE __m256i set1<uint8_t, __m256i>()
+{
+    return _mm256_set1_epi8(1);
+}
+
+template <>
+SFINLINE __m256i set_mask<__m256i>(uint32_t m)
+{
+    return _mm256_set1_epi32(static_cast<int>(m));
+}
+
+template <>
+SFINLINE __m256 set_mask<__m256>(uint32_t m)
+{
+    return _mm256_castsi256_ps(set_mask<__m256i>(m));
+}
+
+template <>
+SFINLINE __m256i set1<uint16_t, __m256i>()
+{
+    return _mm256_set1_epi16(1);
+}
+
+template <>
+SFINLINE __m256 set1<float, __m256>()
+{
+    return _mm256_set1_ps(0.25f);
 }
 
 SFINLINE __m256i or_reg(const __m256i& x, const __m256i& y)
@@ -148,60 +421,214 @@ SFINLINE __m256i or_reg(const __m256i& x, const __m256i& y)
     return _mm256_or_si256(x, y);
 }
 
+SFINLINE __m256 or_reg(const __m256& x, const __m256& y)
+{
+    return _mm256_or_ps(x, y);
+}
+
 SFINLINE __m256i and_reg(const __m256i& x, const __m256i& y)
 {
     return _mm256_and_si256(x, y);
 }
 
+SFINLINE __m256 and_reg(const __m256& x, const __m256& y)
+{
+    return _mm256_and_ps(x, y);
+}
+
 SFINLINE __m256i andnot_reg(const __m256i& x, const __m256i& y)
 {
     return _mm256_andnot_si256(x, y);
 }
 
-SFINLINE __m256i xor_reg(const __m256i& x, const __m256i& y)
+SFINLINE __m256 andnot_reg(const __m256& x, const __m256& y)
+{
+    return _mm256_andnot_ps(x, y);
+}
+
+template <typename T>
+SFINLINE __m256i adds(const __m256i& x, const __m256i& y)
+{
+    return _mm256_adds_epu16(x, y);
+}
+
+template <>
+SFINLINE __m256i adds<uint8_t>(const __m256i& x, const __m256i& y)
+{
+    return _mm256_adds_epu8(x, y);
+}
+
+template <typename T>
+SFINLINE __m256 adds(const __m256& x, const __m256& y)
+{
+    return _mm256_add_ps(x, y);
+}
+
+template <typename T>
+SFINLINE __m256i subs(const __m256i& x, const __m256i& y)
+{
+    return _mm256_subs_epu16(x, y);
+}
+
+template <>
+SFINLINE __m256i subs<uint8_t>(const __m256i& x, const __m256i& y)
+{
+    return _mm256_subs_epu8(x, y);
+}
+
+template <typename T>
+SFINLINE __m256 subs(const __m256& x, const __m256& y)
 {
-    return _mm256_xor_si256(x, y);
+    return _mm256_sub_ps(x, y);
 }
 
+template <typename T>
 SFINLINE __m256i cmpeq(const __m256i& x, const __m256i& y)
+{
+    return _mm256_cmpeq_epi16(x, y);
+}
+
+template <>
+SFINLINE __m256i cmpeq<uint8_t>(const __m256i& x, const __m256i& y)
 {
     return _mm256_cmpeq_epi8(x, y);
 }
 
+template <typename T>
+SFINLINE __m256 cmpeq(const __m256& x, const __m256& y)
+{
+    return _mm256_cmp_ps(x, y, _CMP_EQ_OQ);
+}
+
+template <typename T>
+SFINLINE __m256i average(const __m256i& x, const __m256i& y)
+{
+    return _mm256_avg_epu16(x, y);
+}
+
+template <>
+SFINLINE __m256i average<uint8_t>(const __m256i& x, const __m256i& y)
+{
+    return _mm256_avg_epu8(x, y);
+}
+
+template <typename T, arch_t ARCH>
 SFINLINE __m256i min(const __m256i& x, const __m256i& y)
+{
+    return _mm256_min_epu16(x, y);
+}
+
+template <>
+SFINLINE __m256i min<uint8_t, USE_AVX2>(const __m256i& x, const __m256i& y)
 {
     return _mm256_min_epu8(x, y);
 }
 
+template <typename T, arch_t ARCH>
+SFINLINE __m256 min(const __m256& x, const __m256& y)
+{
+    return _mm256_min_ps(x, y);
+}
+
+template <typename T, arch_t ARCH>
 SFINLINE __m256i max(const __m256i& x, const __m256i& y)
+{
+    return _mm256_max_epu16(x, y);
+}
+
+template <>
+SFINLINE __m256i max<uint8_t, USE_AVX2>(const __m256i& x, const __m256i& y)
 {
     return _mm256_max_epu8(x, y);
 }
 
-SFINLINE __m256i average(const __m256i& x, const __m256i& y)
+template <typename T, arch_t ARCH>
+SFINLINE __m256 max(const __m256& x, const __m256& y)
 {
-    return _mm256_avg_epu8(x, y);
+    return _mm256_max_ps(x, y);
 }
 
+template <arch_t ARCH>
 SFINLINE __m256i blendv(const __m256i& x, const __m256i& y, const __m256i& m)
 {
     return _mm256_blendv_epi8(x, y, m);
 }
 
+template <arch_t ARCH>
+SFINLINE __m256 blendv(const __m256& x, const __m256& y, const __m256& m)
+{
+    return _mm256_blendv_ps(x, y, m);
+}
+
 #endif // __AVX2__
 
-template <typename T>
-SFINLINE T absdiff(const T& x, const T& y)
+/*
+ * Loads the last rem (< sizeof(V)) bytes of a row without reading past them,
+ * for rows which are not followed by any padding.
+ */
+template <typename V>
+SFINLINE V load_tail(const uint8_t* p, int rem)
 {
-    return or_reg(subs(x, y), subs(y, x));
+    alignas(32) uint8_t buff[sizeof(V)] = {};
+    memcpy(buff, p, rem);
+    return load<V>(buff);
 }
 
-template <typename T>
-SFINLINE T clamp(const T& val, const T& minimum, const T& maximum)
+template <typename T, typename V>
+SFINLINE V absdiff(const V& x, const V& y)
+{
+    return or_reg(subs<T>(x, y), subs<T>(y, x));
+}
+
+template <>
+SFINLINE __m128 absdiff<float, __m128>(const __m128& x, const __m128& y)
+{
+    return _mm_sub_ps(_mm_max_ps(x, y), _mm_min_ps(x, y));
+}
+
+#if defined(__AVX2__)
+template <>
+SFINLINE __m256 absdiff<float, __m256>(const __m256& x, const __m256& y)
+{
+    return _mm256_sub_ps(_mm256_max_ps(x, y), _mm256_min_ps(x, y));
+}
+#endif
+
+template <typename T, arch_t ARCH, typename V>
+SFINLINE V clamp(const V& val, const V& minimum, const V& maximum)
+{
+    return min<T, ARCH>(max<T, ARCH>(val, minimum), maximum);
+}
+
+/*
+ * Integer samples: avg(max(avg(a, b) - 1, 0), x), q = 1.
+ * Float samples: (a + b + 2 * x) / 4, q = 0.25.
+ */
+template <typename T, typename V>
+SFINLINE V get_avg(const V& a, const V& b, const V& x, const V& q)
 {
-    return min(max(val, minimum), maximum);
+    return average<T>(subs<T>(average<T>(a, b), q), x);
 }
 
+template <>
+SFINLINE __m128
+get_avg<float, __m128>(const __m128& a, const __m128& b, const __m128& x,
+                       const __m128& q)
+{
+    __m128 t = _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(x, x));
+    return _mm_mul_ps(t, q);
+}
 
+#if defined(__AVX2__)
+template <>
+SFINLINE __m256
+get_avg<float, __m256>(const __m256& a, const __m256& b, const __m256& x,
+                       const __m256& q)
+{
+    __m256 t = _mm256_add_ps(_mm256_add_ps(a, b), _mm256_add_ps(x, x));
+    return _mm256_mul_ps(t, q);
+}
 #endif
 
+
+#endif
@@ -0,0 +1,70 @@
+/*
+thread_pool.h
+
+This file is a part of ReduceFlicker.
+
+Copyright (C) 2016 OKA Motofumi
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+#ifndef REDUCE_FLICKER_THREAD_POOL_H
+#define REDUCE_FLICKER_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Runs the stripes of a frame on a small set of worker threads, where the
+ * job facility of AviSynth+ is not available.
+ * Every GetFrame() call pushes its stripes as one batch. The caller and the
+ * idle workers take stripes from the oldest unfinished batch through an
+ * atomic index, so a worker which has finished one frame helps another one.
+ */
+class ThreadPool {
+    struct Batch {
+        const std::function<void(size_t)>* job;
+        size_t count;
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        int active; // workers inside work(), guarded by mtx.
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Batch*> batches;
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    std::condition_variable finished;
+    bool quit;
+
+    static void work(Batch* b);
+    void workerLoop();
+
+public:
+    ThreadPool(int num_workers);
+    ~ThreadPool();
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+    void run(size_t count, const std::function<void(size_t)>& job);
+};
+
+#endif
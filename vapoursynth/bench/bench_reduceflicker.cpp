@@ -0,0 +1,966 @@
+/*
+bench_reduceflicker.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * Micro-benchmark of every kernel get_main_proc()/get_static_proc() can
+ * return. It calls the function pointers directly on synthetic planes, so
+ * VapourSynth is not needed. Results are written as JSON; each result has a
+ * stable "id", so the output of two builds can be joined on it.
+ *
+ * usage: bench_reduceflicker [--quick] [--min-time sec] [--arch list]
+ *                            [--res list] [--bits list] [--output file]
+ *                            [--sweep] [--perf] [--prefetch list] [--verify]
+ *   --arch : c,sse2,sse41,avx2,avx512 (default: all supported by the cpu)
+ *   --res  : sd,hd,fhd,uhd,8k (default: all, --quick: sd,fhd)
+ *   --bits : 8,10,16,32 (default: all)
+ *   --sweep: use plane sizes from 16KiB to 16MiB (at 8 bits) instead of --res,
+ *            so the working set goes from L2 resident to DRAM resident.
+ *   --perf : also read hardware counters with perf_event_open (Linux only).
+ *   --prefetch: prefetch distances in bytes of the main kernels at strength
+ *            2 and 3, or "all" (default: 0, no prefetch). Combine with
+ *            --sweep to find the distance for each working set size.
+ *   --verify: instead of timing, check every kernel of --arch and --bits
+ *            against the C kernels. Exits with 1 if any of them differs.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "get_proc.h"
+
+#if defined(INTEL_X86_CPU)
+#if defined(__GNUC__)
+    #include <x86intrin.h>
+#else
+    #include <intrin.h>
+#endif
+#endif
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+
+struct resolution_t {
+    const char* name;
+    int width;
+    int height;
+};
+
+static const resolution_t resolutions[] = {
+    {"sd", 720, 480},
+    {"hd", 1280, 720},
+    {"fhd", 1920, 1080},
+    {"uhd", 3840, 2160},
+    {"8k", 7680, 4320},
+};
+
+// named by the size of one 8 bit plane.
+static const resolution_t sweep_sizes[] = {
+    {"16k", 512, 32},
+    {"64k", 512, 128},
+    {"256k", 512, 512},
+    {"1m", 1024, 1024},
+    {"4m", 2048, 2048},
+    {"16m", 4096, 4096},
+};
+
+struct arch_name_t {
+    arch_t arch;
+    const char* name;
+};
+
+static const arch_name_t arch_names[] = {
+    {NO_SIMD, "c"},
+    {USE_SSE2, "sse2"},
+    {USE_SSE41, "sse41"},
+    {USE_AVX2, "avx2"},
+    {USE_AVX512, "avx512"},
+};
+
+enum stride_mode_t {
+    STRIDE_ALIGNED, // row size rounded up to 64 bytes.
+    STRIDE_PAGE,    // row size rounded up to 4096 bytes.
+};
+
+
+struct options_t {
+    double minTime = 0.2;
+    std::vector<arch_t> archs;
+    std::vector<resolution_t> res;
+    std::vector<int> bits;
+    const char* output = nullptr;
+    bool perf = false;
+    std::vector<int> prefetch;
+    bool verify = false;
+};
+
+
+static std::vector<std::string> split(const char* list)
+{
+    std::vector<std::string> ret;
+    std::string s(list);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        if (end > pos) {
+            ret.push_back(s.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return ret;
+}
+
+
+static const char* get_arch_name(arch_t arch)
+{
+    for (const auto& a : arch_names) {
+        if (a.arch == arch) {
+            return a.name;
+        }
+    }
+    return "unknown";
+}
+
+
+static std::vector<arch_t> get_supported_archs()
+{
+    std::vector<arch_t> ret;
+    for (int opt = 0; opt <= 4; ++opt) {
+        arch_t arch = get_arch(opt);
+        if (std::find(ret.begin(), ret.end(), arch) == ret.end()) {
+            ret.push_back(arch);
+        }
+    }
+    return ret;
+}
+
+
+static std::string get_cpu_name()
+{
+#if defined(INTEL_X86_CPU)
+    char brand[49];
+    get_cpu_brand(brand);
+    std::string ret(brand);
+    ret.erase(0, ret.find_first_not_of(' '));
+    return ret;
+#else
+    return "unknown";
+#endif
+}
+
+
+static inline uint64_t read_cycles()
+{
+#if defined(INTEL_X86_CPU)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * Hardware counters of this thread, user space only. Each one is opened on
+ * its own, so a counter the cpu (or a VM) does not have is just missing.
+ */
+class PerfCounters {
+public:
+    enum {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,
+        LLC_MISSES,
+        BACKEND_STALLS,
+        NUM_COUNTERS
+    };
+
+private:
+    int fds[NUM_COUNTERS];
+
+public:
+    static constexpr const char* names[NUM_COUNTERS] = {
+        "hw_cycles", "instructions", "l1d_misses", "llc_misses",
+        "backend_stalls"
+    };
+
+    PerfCounters()
+    {
+        for (auto& fd : fds) {
+            fd = -1;
+        }
+#if defined(__linux__)
+        const uint64_t l1d = PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const struct {
+            uint32_t type;
+            uint64_t config;
+        } events[NUM_COUNTERS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, l1d},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+        };
+        for (int i = 0; i < NUM_COUNTERS; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].type;
+            attr.config = events[i].config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = static_cast<int>(
+                syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    bool available(int i) const { return fds[i] >= 0; }
+
+    bool any() const
+    {
+        for (int i = 0; i < NUM_COUNTERS; ++i) {
+            if (available(i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void read(uint64_t* values) const
+    {
+        for (int i = 0; i < NUM_COUNTERS; ++i) {
+            values[i] = 0;
+#if defined(__linux__)
+            if (fds[i] >= 0 && ::read(fds[i], &values[i], 8) != 8) {
+                values[i] = 0;
+            }
+#endif
+        }
+    }
+};
+
+constexpr const char* PerfCounters::names[];
+
+
+class Plane {
+    std::vector<uint8_t> buff;
+    uint8_t* ptr;
+
+public:
+    Plane(size_t size) : buff(size + 64)
+    {
+        ptr = reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(buff.data()) + 63) & ~uintptr_t(63));
+    }
+    uint8_t* data() { return ptr; }
+};
+
+
+/*
+ * Seven source frames which differ from each other by a small noise, like
+ * a real clip, plus a destination.
+ */
+struct planes_t {
+    int width;
+    int height;
+    int stride;
+    std::vector<Plane> src;
+    Plane dst;
+
+    planes_t(int w, int h, int bits, stride_mode_t mode) :
+        width(w), height(h), dst(0)
+    {
+        const int bytes = bits == 8 ? 1 : bits == 32 ? 4 : 2;
+        const int rowsize = w * bytes;
+        stride = mode == STRIDE_PAGE ? (rowsize + 4095) & ~4095
+                                     : (rowsize + 63) & ~63;
+        const size_t size = static_cast<size_t>(stride) * h;
+
+        dst = Plane(size);
+        for (int i = 0; i < 7; ++i) {
+            src.emplace_back(size);
+        }
+
+        std::mt19937 rng(bits * 7 + w);
+        const int maxval = bits == 32 ? 0 : (1 << bits) - 1;
+        for (int i = 0; i < 7; ++i) {
+            for (int y = 0; y < h; ++y) {
+                uint8_t* row = src[i].data() + static_cast<size_t>(y) * stride;
+                for (int x = 0; x < w; ++x) {
+                    int base = ((x >> 3) * 37 + (y >> 3) * 101) & 0xFF;
+                    int noise = static_cast<int>(rng() % 9) - 4;
+                    if (bits == 8) {
+                        row[x] = static_cast<uint8_t>(std::min(std::max(base + noise, 0), 255));
+                    } else if (bits == 32) {
+                        reinterpret_cast<float*>(row)[x] = (base + noise * 0.5f) / 255.0f;
+                    } else {
+                        int v = (base << (bits - 8)) + noise;
+                        reinterpret_cast<uint16_t*>(row)[x] =
+                            static_cast<uint16_t>(std::min(std::max(v, 0), maxval));
+                    }
+                }
+            }
+        }
+    }
+};
+
+
+struct result_t {
+    double nsPerCall;
+    double cyclesPerCall;
+    int iterations;
+    bool hasCounters;
+    double counters[PerfCounters::NUM_COUNTERS];
+};
+
+
+static double median(std::vector<double>& v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+
+/*
+ * The counters are read outside of the timed part, so perf does not change
+ * ns_per_call much.
+ */
+template <typename F>
+static result_t measure(F call, double min_time, const PerfCounters* perf)
+{
+    using clock = std::chrono::steady_clock;
+    const int nc = PerfCounters::NUM_COUNTERS;
+
+    call();
+
+    std::vector<double> ns;
+    std::vector<double> cycles;
+    std::vector<double> counts[nc];
+    uint64_t before[nc], after[nc];
+    auto start = clock::now();
+    double elapsed = 0.0;
+    while (ns.size() < 3 || elapsed < min_time) {
+        if (perf) {
+            perf->read(before);
+        }
+        auto t0 = clock::now();
+        uint64_t c0 = read_cycles();
+        call();
+        uint64_t c1 = read_cycles();
+        auto t1 = clock::now();
+        if (perf) {
+            perf->read(after);
+            for (int i = 0; i < nc; ++i) {
+                counts[i].push_back(static_cast<double>(after[i] - before[i]));
+            }
+        }
+        ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+        cycles.push_back(static_cast<double>(c1 - c0));
+        elapsed = std::chrono::duration<double>(t1 - start).count();
+    }
+
+    // medians are less sensitive to preemption than means.
+    result_t r = {median(ns), median(cycles), static_cast<int>(ns.size()),
+                  perf != nullptr, {}};
+    for (int i = 0; perf && i < nc; ++i) {
+        r.counters[i] = median(counts[i]);
+    }
+    return r;
+}
+
+
+static void
+write_result(FILE* out, bool& first, const std::string& id, const char* kernel,
+             arch_t arch, int strength, bool aggressive, int bits,
+             int kernel_bits, const planes_t& p, const char* stride_mode,
+             size_t bytes, const result_t& r)
+{
+    const double pixels = static_cast<double>(p.width) * p.height;
+    fprintf(out,
+            "%s\n    {\"id\": \"%s\", \"kernel\": \"%s\", \"arch\": \"%s\", "
+            "\"strength\": %d, \"aggressive\": %s, \"bits\": %d, "
+            "\"kernel_bits\": %d, \"width\": %d, \"height\": %d, "
+            "\"stride\": %d, \"stride_mode\": \"%s\", \"iterations\": %d, "
+            "\"ns_per_call\": %.0f, \"pixels_per_sec\": %.4e, "
+            "\"gb_per_sec\": %.3f, \"cycles_per_pixel\": %.4f",
+            first ? "" : ",", id.c_str(), kernel, get_arch_name(arch),
+            strength, aggressive ? "true" : "false", bits, kernel_bits,
+            p.width, p.height, p.stride, stride_mode, r.iterations,
+            r.nsPerCall, pixels * 1e9 / r.nsPerCall, bytes / r.nsPerCall,
+            r.cyclesPerCall / pixels);
+
+    // per call. null if the counter could not be opened.
+    if (r.hasCounters) {
+        const int cyc = PerfCounters::CYCLES, ins = PerfCounters::INSTRUCTIONS;
+        for (int i = 0; i < PerfCounters::NUM_COUNTERS; ++i) {
+            if (r.counters[i] > 0) {
+                fprintf(out, ", \"%s\": %.0f", PerfCounters::names[i],
+                        r.counters[i]);
+            } else {
+                fprintf(out, ", \"%s\": null", PerfCounters::names[i]);
+            }
+        }
+        if (r.counters[cyc] > 0 && r.counters[ins] > 0) {
+            fprintf(out, ", \"ipc\": %.3f", r.counters[ins] / r.counters[cyc]);
+        } else {
+            fprintf(out, ", \"ipc\": null");
+        }
+    }
+    fprintf(out, "}");
+    fflush(out);
+    first = false;
+}
+
+
+static void
+bench_planes(FILE* out, bool& first, const options_t& opt, planes_t& p,
+             const resolution_t& res, int bits, const char* stride_mode,
+             const PerfCounters* perf)
+{
+    const size_t plane_bytes = static_cast<size_t>(p.width) * p.height
+        * (bits == 8 ? 1 : bits == 32 ? 4 : 2);
+
+    const uint8_t* currp = p.src[3].data();
+    const uint8_t* prevp[] = {p.src[2].data(), p.src[1].data(), p.src[0].data()};
+    const uint8_t* nextp[] = {p.src[4].data(), p.src[5].data(), p.src[6].data()};
+
+    for (arch_t arch : opt.archs) {
+        // the same mapping as ReduceFlicker::ReduceFlicker().
+        int kbits = bits;
+        if (arch != USE_SSE2 && kbits == 10) {
+            kbits = 16;
+        }
+        for (int strength = 1; strength <= 3; ++strength) {
+            const int inputs = strength == 1 ? 4 : strength == 2 ? 5 : 7;
+            for (int agr = 0; agr <= 1; ++agr) {
+                proc_filter_t proc = get_main_proc(arch, strength, agr != 0,
+                                                   kbits, STORE_STREAM, 0,
+                                                   ACCESS_ALIGNED);
+                if (!proc) {
+                    continue;
+                }
+                // "main" streams dst as the filter did before store=0 existed.
+                // the C kernels have no store or prefetch variants, and
+                // strength 1 has no prefetch variants.
+                std::vector<std::pair<store_t, int>> variants;
+                for (int pf : opt.prefetch) {
+                    if (pf > 0 && (arch == NO_SIMD || strength == 1)) {
+                        continue;
+                    }
+                    variants.push_back({STORE_STREAM, pf});
+                    if (arch != NO_SIMD) {
+                        variants.push_back({STORE_TEMPORAL, pf});
+                    }
+                }
+                for (const auto& v : variants) {
+                    const int pf = v.second;
+                    proc_filter_t tproc = get_main_proc(arch, strength,
+                                                        agr != 0, kbits,
+                                                        v.first, pf,
+                                                        ACCESS_ALIGNED);
+                    result_t r = measure([&]() {
+                        // proc_c modifies the stride arrays.
+                        int pstride[] = {p.stride, p.stride, p.stride};
+                        int nstride[] = {p.stride, p.stride, p.stride};
+                        tproc(p.dst.data(), currp, prevp, nextp, p.stride,
+                              p.stride, pstride, nstride, p.width, p.height);
+                    }, opt.minTime, perf);
+
+                    std::string kind = v.first == STORE_TEMPORAL
+                        ? "main-temporal" : "main";
+                    if (pf > 0) {
+                        kind += "-pf" + std::to_string(pf);
+                    }
+                    std::string id = std::string(get_arch_name(arch)) + "/"
+                        + kind + "/s" + std::to_string(strength)
+                        + (agr ? "/a" : "/n") + "/" + std::to_string(bits)
+                        + "bit/" + res.name + "/" + stride_mode;
+                    write_result(out, first, id, kind.c_str(), arch, strength,
+                                 agr != 0, bits, kbits, p, stride_mode,
+                                 plane_bytes * (inputs + 1), r);
+                }
+
+                // a view starting one sample into each plane, as a crop
+                // gives. The last sample of each row is left out, so the
+                // view stays inside the buffers.
+                if (arch != NO_SIMD) {
+                    proc_filter_t uproc = get_main_proc(arch, strength,
+                                                        agr != 0, kbits,
+                                                        STORE_STREAM, 0,
+                                                        ACCESS_UNALIGNED);
+                    const size_t sample = plane_bytes / p.width / p.height;
+                    const uint8_t* ucurrp = currp + sample;
+                    const uint8_t* uprevp[3], *unextp[3];
+                    for (int i = 0; i < 3; ++i) {
+                        uprevp[i] = prevp[i] + sample;
+                        unextp[i] = nextp[i] + sample;
+                    }
+                    result_t r = measure([&]() {
+                        int pstride[] = {p.stride, p.stride, p.stride};
+                        int nstride[] = {p.stride, p.stride, p.stride};
+                        uproc(p.dst.data() + sample, ucurrp, uprevp, unextp,
+                              p.stride, p.stride, pstride, nstride,
+                              p.width - 1, p.height);
+                    }, opt.minTime, perf);
+
+                    std::string id = std::string(get_arch_name(arch))
+                        + "/main-unaligned/s" + std::to_string(strength)
+                        + (agr ? "/a" : "/n") + "/" + std::to_string(bits)
+                        + "bit/" + res.name + "/" + stride_mode;
+                    write_result(out, first, id, "main-unaligned", arch,
+                                 strength, agr != 0, bits, kbits, p,
+                                 stride_mode, plane_bytes * (inputs + 1), r);
+                }
+
+                // the static-region wrapper on the noisy planes (no tile is
+                // skipped) and on a still scene (every tile is skipped).
+                proc_static_t sproc = get_static_proc(arch, strength, kbits);
+                const uint8_t* still[] = {currp, currp, currp};
+                for (int s = 0; s <= 1; ++s) {
+                    const uint8_t** sprevp = s ? still : prevp;
+                    const uint8_t** snextp = s ? still : nextp;
+                    result_t rs = measure([&]() {
+                        int pstride[] = {p.stride, p.stride, p.stride};
+                        int nstride[] = {p.stride, p.stride, p.stride};
+                        sproc(proc, p.dst.data(), currp, sprevp, snextp,
+                              p.stride, p.stride, pstride, nstride, p.width,
+                              p.height);
+                    }, opt.minTime, perf);
+
+                    const char* kind = s ? "static-still" : "static";
+                    std::string sid = std::string(get_arch_name(arch)) + "/"
+                        + kind + "/s" + std::to_string(strength)
+                        + (agr ? "/a" : "/n") + "/" + std::to_string(bits)
+                        + "bit/" + res.name + "/" + stride_mode;
+                    write_result(out, first, sid, kind, arch, strength,
+                                 agr != 0, bits, kbits, p, stride_mode,
+                                 plane_bytes * (inputs + 1), rs);
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ * The C kernels are the reference. The planes are small, and their width is
+ * not a multiple of any vector size, so every kernel runs its row tail.
+ * Returns the number of kernels whose output differs.
+ */
+static int verify_planes(const options_t& opt, int bits)
+{
+    const int width = 333, height = 21;
+    planes_t p(width, height, bits, STRIDE_ALIGNED);
+    const size_t sample = bits == 8 ? 1 : bits == 32 ? 4 : 2;
+    const size_t size = static_cast<size_t>(p.stride) * height;
+    Plane ref(size);
+    int failures = 0;
+
+    const uint8_t* currp = p.src[3].data();
+    const uint8_t* prevp[] = {p.src[2].data(), p.src[1].data(), p.src[0].data()};
+    const uint8_t* nextp[] = {p.src[4].data(), p.src[5].data(), p.src[6].data()};
+
+    // for the static kernels: neighbors equal to curr in every tile, and in
+    // two of three tiles, so copied and processed tiles alternate. 64 is
+    // STATIC_TILE_SIZE of proc_filter.h.
+    const size_t tile = 64;
+    std::vector<Plane> mixed;
+    for (int i = 0; i < 6; ++i) {
+        mixed.emplace_back(size);
+        memcpy(mixed[i].data(), (i < 3 ? prevp[i] : nextp[i - 3]), size);
+        for (int y = 0; y < height; ++y) {
+            const size_t row = static_cast<size_t>(y) * p.stride;
+            for (size_t x = 0; x < width * sample; x += tile) {
+                if ((x / tile + y) % 3 != 0) {
+                    const size_t n = std::min(tile, width * sample - x);
+                    memcpy(mixed[i].data() + row + x, currp + row + x, n);
+                }
+            }
+        }
+    }
+    // copies of curr whose stride padding differs, as it does between
+    // frames. Every tile of them must be skipped.
+    std::vector<Plane> copies;
+    for (int i = 0; i < 3; ++i) {
+        copies.emplace_back(size);
+        memset(copies[i].data(), 0x11 * (i + 1), size);
+        for (int y = 0; y < height; ++y) {
+            const size_t row = static_cast<size_t>(y) * p.stride;
+            memcpy(copies[i].data() + row, currp + row, width * sample);
+        }
+    }
+    const uint8_t* still[] = {copies[0].data(), copies[1].data(),
+                              copies[2].data()};
+    const size_t tiles = (width * sample + tile - 1) / tile * height;
+    const uint8_t* mprevp[] = {mixed[0].data(), mixed[1].data(), mixed[2].data()};
+    const uint8_t* mnextp[] = {mixed[3].data(), mixed[4].data(), mixed[5].data()};
+
+    // dst and ref are filled with the same pattern before each call. The
+    // aligned kernels may write into the stride padding, so their rows are
+    // compared up to width. The unaligned ones must not write outside of the
+    // view, so their rows are compared up to the stride.
+    auto run = [&](proc_filter_t proc, proc_static_t sproc, uint8_t* dstp,
+                   size_t offset, const uint8_t** pv, const uint8_t** nx,
+                   size_t w) -> size_t {
+        int pstride[] = {p.stride, p.stride, p.stride};
+        int nstride[] = {p.stride, p.stride, p.stride};
+        const uint8_t* opv[3], *onx[3];
+        for (int i = 0; i < 3; ++i) {
+            opv[i] = pv[i] + offset;
+            onx[i] = nx[i] + offset;
+        }
+        memset(dstp, 0xA5, size);
+        if (sproc) {
+            return sproc(proc, dstp + offset, currp + offset, opv, onx,
+                         p.stride, p.stride, pstride, nstride, w, height);
+        }
+        proc(dstp + offset, currp + offset, opv, onx, p.stride, p.stride,
+             pstride, nstride, w, height);
+        return 0;
+    };
+    // the SIMD float average adds in another order than proc_c, so it may
+    // differ in the last bit.
+    auto same_row = [&](const uint8_t* a, const uint8_t* b, size_t rowsize) {
+        if (bits != 32) {
+            return memcmp(a, b, rowsize) == 0;
+        }
+        const float* fa = reinterpret_cast<const float*>(a);
+        const float* fb = reinterpret_cast<const float*>(b);
+        for (size_t x = 0; x < rowsize / sizeof(float); ++x) {
+            if (std::abs(fa[x] - fb[x]) > 1e-6f) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto check = [&](const std::string& id, size_t rowsize) {
+        for (int y = 0; y < height; ++y) {
+            const size_t row = static_cast<size_t>(y) * p.stride;
+            if (!same_row(p.dst.data() + row, ref.data() + row, rowsize)) {
+                fprintf(stderr, "%s: differs from c at row %d.\n", id.c_str(), y);
+                ++failures;
+                return;
+            }
+        }
+    };
+
+    for (arch_t arch : opt.archs) {
+        if (arch == NO_SIMD) {
+            continue;
+        }
+        // the same mapping as ReduceFlicker::ReduceFlicker().
+        const int kbits = arch != USE_SSE2 && bits == 10 ? 16 : bits;
+        for (int strength = 1; strength <= 3; ++strength) {
+            for (int agr = 0; agr <= 1; ++agr) {
+                const std::string name = std::string(get_arch_name(arch))
+                    + "/s" + std::to_string(strength) + (agr ? "/a/" : "/n/")
+                    + std::to_string(bits) + "bit";
+                proc_filter_t cproc = get_main_proc(NO_SIMD, strength,
+                                                    agr != 0, bits,
+                                                    STORE_STREAM, 0,
+                                                    ACCESS_ALIGNED);
+
+                run(cproc, nullptr, ref.data(), 0, prevp, nextp, width);
+                for (store_t store : {STORE_STREAM, STORE_TEMPORAL}) {
+                    for (int pf : prefetch_distances) {
+                        proc_filter_t proc = get_main_proc(arch, strength,
+                                                           agr != 0, kbits,
+                                                           store, pf,
+                                                           ACCESS_ALIGNED);
+                        run(proc, nullptr, p.dst.data(), 0, prevp, nextp,
+                            width);
+                        check(name + "/main" + (store == STORE_TEMPORAL ? "-temporal" : "")
+                              + "-pf" + std::to_string(pf), width * sample);
+                    }
+                }
+
+                // views at odd offsets and widths, as crops give.
+                proc_filter_t uproc = get_main_proc(arch, strength, agr != 0,
+                                                    kbits, STORE_STREAM, 0,
+                                                    ACCESS_UNALIGNED);
+                for (size_t x : {1, 3, 17}) {
+                    for (size_t w : {1, 7, 31, 65, 129, 315}) {
+                        run(cproc, nullptr, ref.data(), x * sample, prevp,
+                            nextp, w);
+                        run(uproc, nullptr, p.dst.data(), x * sample, prevp,
+                            nextp, w);
+                        check(name + "/main-unaligned-x" + std::to_string(x)
+                              + "-w" + std::to_string(w), p.stride);
+                    }
+                }
+
+                proc_static_t sproc = get_static_proc(arch, strength, kbits);
+                proc_filter_t proc = get_main_proc(arch, strength, agr != 0,
+                                                   kbits, STORE_STREAM, 0,
+                                                   ACCESS_ALIGNED);
+                const uint8_t** spv[] = {prevp, mprevp, still};
+                const uint8_t** snx[] = {nextp, mnextp, still};
+                const char* kinds[] = {"static", "static-mixed", "static-still"};
+                for (int s = 0; s < 3; ++s) {
+                    run(cproc, nullptr, ref.data(), 0, spv[s], snx[s], width);
+                    const size_t skipped = run(proc, sproc, p.dst.data(), 0,
+                                               spv[s], snx[s], width);
+                    check(name + "/" + kinds[s], width * sample);
+                    if (s == 2 && skipped != tiles) {
+                        fprintf(stderr, "%s/%s: skipped %zu of %zu tiles.\n",
+                                name.c_str(), kinds[s], skipped, tiles);
+                        ++failures;
+                    }
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: bench_reduceflicker [--quick] [--min-time sec] [--arch list]\n"
+            "                           [--res list] [--bits list] [--output file]\n"
+            "                           [--sweep] [--perf] [--prefetch list] [--verify]\n"
+            "  --arch : c,sse2,sse41,avx2,avx512 (default: all supported by the cpu)\n"
+            "  --res  : sd,hd,fhd,uhd,8k (default: all, --quick: sd,fhd)\n"
+            "  --bits : 8,10,16,32 (default: all)\n"
+            "  --sweep: plane sizes from 16KiB to 16MiB instead of --res\n"
+            "  --perf : read hardware counters (Linux only)\n"
+            "  --prefetch: 0,256,512,1024,2048 or all (default: 0)\n"
+            "  --verify: check every kernel against the C kernels\n");
+    exit(1);
+}
+
+
+static options_t parse_args(int argc, char** argv)
+{
+    options_t opt;
+    std::vector<arch_t> supported = get_supported_archs();
+    bool quick = false, sweep = false;
+    const char *archs = nullptr, *res = nullptr, *bits = nullptr;
+    const char* prefetch = "0";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a(argv[i]);
+        bool has_value = i + 1 < argc;
+        if (a == "--quick") {
+            quick = true;
+        } else if (a == "--min-time" && has_value) {
+            opt.minTime = atof(argv[++i]);
+        } else if (a == "--arch" && has_value) {
+            archs = argv[++i];
+        } else if (a == "--res" && has_value) {
+            res = argv[++i];
+        } else if (a == "--bits" && has_value) {
+            bits = argv[++i];
+        } else if (a == "--output" && has_value) {
+            opt.output = argv[++i];
+        } else if (a == "--sweep") {
+            sweep = true;
+        } else if (a == "--perf") {
+            opt.perf = true;
+        } else if (a == "--prefetch" && has_value) {
+            prefetch = argv[++i];
+        } else if (a == "--verify") {
+            opt.verify = true;
+        } else {
+            usage();
+        }
+    }
+
+    if (quick) {
+        opt.minTime = std::min(opt.minTime, 0.02);
+        if (!res && !sweep) {
+            res = "sd,fhd";
+        }
+    }
+
+    if (!archs) {
+        opt.archs = supported;
+    } else {
+        for (const auto& name : split(archs)) {
+            const arch_name_t* found = nullptr;
+            for (const auto& a : arch_names) {
+                if (name == a.name) {
+                    found = &a;
+                }
+            }
+            if (!found) {
+                usage();
+            }
+            if (std::find(supported.begin(), supported.end(), found->arch)
+                    == supported.end()) {
+                fprintf(stderr, "%s is not supported by this cpu. skipped.\n",
+                        found->name);
+                continue;
+            }
+            opt.archs.push_back(found->arch);
+        }
+    }
+
+    if (sweep) {
+        if (res) {
+            usage();
+        }
+        opt.res.assign(std::begin(sweep_sizes), std::end(sweep_sizes));
+    }
+    for (const auto& r : resolutions) {
+        if (sweep) {
+            break;
+        }
+        if (!res) {
+            opt.res.push_back(r);
+            continue;
+        }
+        for (const auto& name : split(res)) {
+            if (name == r.name) {
+                opt.res.push_back(r);
+            }
+        }
+    }
+
+    for (const auto& b : split(bits ? bits : "8,10,16,32")) {
+        int v = atoi(b.c_str());
+        if (v != 8 && v != 10 && v != 16 && v != 32) {
+            usage();
+        }
+        opt.bits.push_back(v);
+    }
+
+    if (std::string(prefetch) == "all") {
+        opt.prefetch.assign(std::begin(prefetch_distances),
+                            std::end(prefetch_distances));
+    } else {
+        for (const auto& d : split(prefetch)) {
+            int v = atoi(d.c_str());
+            if (std::find(std::begin(prefetch_distances),
+                          std::end(prefetch_distances), v)
+                    == std::end(prefetch_distances)) {
+                usage();
+            }
+            opt.prefetch.push_back(v);
+        }
+    }
+
+    if (opt.archs.empty() || opt.res.empty() || opt.prefetch.empty()) {
+        usage();
+    }
+    return opt;
+}
+
+
+int main(int argc, char** argv)
+{
+    options_t opt = parse_args(argc, argv);
+
+    if (opt.verify) {
+        int failures = 0;
+        for (int bits : opt.bits) {
+            failures += verify_planes(opt, bits);
+        }
+        if (failures > 0) {
+            fprintf(stderr, "%d kernels differ from the C kernels.\n",
+                    failures);
+            return 1;
+        }
+        fprintf(stderr, "every kernel matches the C kernels.\n");
+        return 0;
+    }
+
+    FILE* out = opt.output ? fopen(opt.output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "failed to open %s.\n", opt.output);
+        return 1;
+    }
+
+    PerfCounters counters;
+    const PerfCounters* perf = nullptr;
+    if (opt.perf) {
+        if (counters.any()) {
+            perf = &counters;
+        } else {
+            fprintf(stderr, "no hardware counter is available "
+                            "(check /proc/sys/kernel/perf_event_paranoid).\n");
+        }
+    }
+
+    fprintf(out, "{\n  \"cpu\": \"%s\",\n  \"compiler\": \"%s\",\n"
+                 "  \"cycles\": \"tsc\",\n  \"perf\": %s,\n  \"results\": [",
+            get_cpu_name().c_str(),
+#if defined(__clang__)
+            "clang " __clang_version__
+#elif defined(__GNUC__)
+            "gcc " __VERSION__
+#elif defined(_MSC_VER)
+            "msvc"
+#else
+            "unknown"
+#endif
+            , perf ? "true" : "false");
+
+    bool first = true;
+    const stride_mode_t modes[] = {STRIDE_ALIGNED, STRIDE_PAGE};
+    for (const auto& res : opt.res) {
+        for (int bits : opt.bits) {
+            for (stride_mode_t mode : modes) {
+                planes_t p(res.width, res.height, bits, mode);
+                const char* name = mode == STRIDE_PAGE ? "page" : "aligned";
+                bench_planes(out, first, opt, p, res, bits, name, perf);
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -21,209 +21,531 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
 
-#include <map>
-#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <vector>
 #include "ReduceFlicker.h"
+#include "autotune.h"
 #include "myvshelper.h"
-#include "proc_filter.h"
+#include "trace.h"
 
 
-template <int STRENGTH>
+/*
+ * Frames from to to, in the given order. See fetch_order.h for how it is
+ * chosen.
+ */
 static void
-request_frames(int n, int nf, VSNodeRef* clip, const VSAPI* api,
-    VSFrameContext* ctx) noexcept
+request_range(int from, int to, fetch_order_t order, VSNode* clip,
+    const VSAPI* api, VSFrameContext* ctx) noexcept
 {
-    api->requestFrameFilter(n, clip, ctx);
-    api->requestFrameFilter(std::max(n - 1, 0), clip, ctx);
-    api->requestFrameFilter(std::max(n - 2, 0), clip, ctx);
-    api->requestFrameFilter(std::min(n + 1, nf), clip, ctx);
-    if (STRENGTH > 1) {
-        api->requestFrameFilter(std::min(n + 2, nf), clip, ctx);
-        if (STRENGTH > 2) {
-            api->requestFrameFilter(std::max(n - 3, 0), clip, ctx);
-            api->requestFrameFilter(std::min(n + 3, nf), clip, ctx);
+    if (order == ORDER_ASCENDING) {
+        for (int i = from; i <= to; ++i) {
+            api->requestFrameFilter(i, clip, ctx);
+        }
+    } else {
+        for (int i = to; i >= from; --i) {
+            api->requestFrameFilter(i, clip, ctx);
         }
     }
 }
 
 
+// the frames of the window of n, each once.
+template <int STRENGTH>
+static void
+request_frames(int n, int nf, fetch_order_t order, VSNode* clip,
+    const VSAPI* api, VSFrameContext* ctx) noexcept
+{
+    request_range(std::max(n - (STRENGTH > 2 ? 3 : 2), 0),
+                  std::min(n + STRENGTH, nf), order, clip, api, ctx);
+}
+
+
+/*
+ * Frames outside [first, last] are replaced by the nearest one inside, the
+ * same way as at the ends of the clip.
+ */
 template <int STRENGTH>
 static void
-recieve_frames(const VSFrameRef** curr, const VSFrameRef** prev,
-    const VSFrameRef** next, int n, int nf, VSNodeRef* clip,
+recieve_frames(const VSFrame** curr, const VSFrame** prev,
+    const VSFrame** next, int n, int first, int last, VSNode* clip,
     const VSAPI* api, VSFrameContext* ctx) noexcept
 {
     *curr = api->getFrameFilter(n, clip, ctx);
-    prev[0] = api->getFrameFilter(std::max(n - 1, 0), clip, ctx);
-    prev[1] = api->getFrameFilter(std::max(n - 2, 0), clip, ctx);
-    next[0] = api->getFrameFilter(std::min(n + 1, nf), clip, ctx);
+    prev[0] = api->getFrameFilter(std::max(n - 1, first), clip, ctx);
+    prev[1] = api->getFrameFilter(std::max(n - 2, first), clip, ctx);
+    next[0] = api->getFrameFilter(std::min(n + 1, last), clip, ctx);
     if (STRENGTH > 1) {
-        next[1] = api->getFrameFilter(std::min(n + 2, nf), clip, ctx);
+        next[1] = api->getFrameFilter(std::min(n + 2, last), clip, ctx);
         if (STRENGTH > 2) {
-            prev[2] = api->getFrameFilter(std::max(n - 3, 0), clip, ctx);
-            next[2] = api->getFrameFilter(std::min(n + 3, nf), clip, ctx);
+            prev[2] = api->getFrameFilter(std::max(n - 3, first), clip, ctx);
+            next[2] = api->getFrameFilter(std::min(n + 3, last), clip, ctx);
         }
     }
 }
 
 
+/*
+ * prev/next clips. Frame n of each of them stands in for one frame of the
+ * window, so nothing but frame n is requested from any clip.
+ */
+static void
+request_neighbor_frames(int n, int strength, fetch_order_t order,
+    VSNode* clip, VSNode** prev, VSNode** next, const VSAPI* api,
+    VSFrameContext* ctx) noexcept
+{
+    const int num_prev = strength > 2 ? 3 : 2;
+    if (order == ORDER_ASCENDING) {
+        for (int i = num_prev - 1; i >= 0; --i) {
+            api->requestFrameFilter(n, prev[i], ctx);
+        }
+        api->requestFrameFilter(n, clip, ctx);
+        for (int i = 0; i < strength; ++i) {
+            api->requestFrameFilter(n, next[i], ctx);
+        }
+    } else {
+        for (int i = strength - 1; i >= 0; --i) {
+            api->requestFrameFilter(n, next[i], ctx);
+        }
+        api->requestFrameFilter(n, clip, ctx);
+        for (int i = 0; i < num_prev; ++i) {
+            api->requestFrameFilter(n, prev[i], ctx);
+        }
+    }
+}
+
+
+static void
+recieve_neighbor_frames(const VSFrame** curr, const VSFrame** prevf,
+    const VSFrame** nextf, int n, int strength, VSNode* clip, VSNode** prev,
+    VSNode** next, const VSAPI* api, VSFrameContext* ctx) noexcept
+{
+    *curr = api->getFrameFilter(n, clip, ctx);
+    for (int i = 0; i < (strength > 2 ? 3 : 2); ++i) {
+        prevf[i] = api->getFrameFilter(n, prev[i], ctx);
+    }
+    for (int i = 0; i < strength; ++i) {
+        nextf[i] = api->getFrameFilter(n, next[i], ctx);
+    }
+}
+
+
+/*
+ * With scenechange=1 the window is grown by one frame per side and stage, and
+ * a frame is requested only after its neighbour toward n turned out to be in
+ * the same scene. So nothing beyond a cut is ever decoded.
+ * The progress is kept in the state of frame_data_t, four bits per side:
+ *   bits 0-1: number of frames known to be in the scene
+ *   bit 2: the side is closed
+ *   bit 3: the next frame of the side has been requested
+ * bits 0-3 are for the previous side and bits 4-7 for the next side.
+ */
+enum : intptr_t {
+    SC_COUNT = 0x3,
+    SC_DONE = 0x4,
+    SC_PENDING = 0x8,
+    SC_NEXT_SHIFT = 4,
+};
+
+
+static bool
+is_scene_change(const VSFrame* f, const char* key, const VSAPI* api) noexcept
+{
+    return get_arg(key, false, 0, api->getFramePropertiesRO(f), api);
+}
+
+
+/*
+ * Advances one side of the window and returns its new state.
+ * dir is -1 for the previous side and 1 for the next side.
+ */
+static intptr_t
+grow_scene_window(intptr_t side, int n, int dir, int limit, int end,
+    VSNode* clip, const VSAPI* api, VSFrameContext* ctx) noexcept
+{
+    // the cut between two frames may be marked on either of them.
+    const char* inner = dir < 0 ? "_SceneChangePrev" : "_SceneChangeNext";
+    const char* outer = dir < 0 ? "_SceneChangeNext" : "_SceneChangePrev";
+    int count = static_cast<int>(side & SC_COUNT);
+
+    if (side & SC_PENDING) {
+        const VSFrame* f = api->getFrameFilter(n + dir * (count + 1), clip, ctx);
+        bool cut = is_scene_change(f, outer, api);
+        api->freeFrame(f);
+        if (cut) {
+            return count | SC_DONE;
+        }
+        ++count;
+    }
+
+    const int edge = n + dir * count;
+    const VSFrame* f = api->getFrameFilter(edge, clip, ctx);
+    bool cut = is_scene_change(f, inner, api);
+    api->freeFrame(f);
+    if (cut || count == limit || edge == end) {
+        return count | SC_DONE;
+    }
+    api->requestFrameFilter(edge + dir, clip, ctx);
+    return count | SC_PENDING;
+}
+
+
 template <int STRENGTH>
 static void
 prepare_pointers(const uint8_t** currp, const uint8_t** prevp,
     const uint8_t** nextp, int& cstride, int* pstride,
-    int* nstride, const VSFrameRef* curr, const VSFrameRef** prev,
-    const VSFrameRef** next, int plane, const VSAPI* api) noexcept
+    int* nstride, const VSFrame* curr, const VSFrame** prev,
+    const VSFrame** next, int plane, const VSAPI* api) noexcept
 {
     *currp = api->getReadPtr(curr, plane);
-    cstride = api->getStride(curr, plane);
+    cstride = static_cast<int>(api->getStride(curr, plane));
     prevp[0] = api->getReadPtr(prev[0], plane);
-    pstride[0] = api->getStride(prev[0], plane);
+    pstride[0] = static_cast<int>(api->getStride(prev[0], plane));
     prevp[1] = api->getReadPtr(prev[1], plane);
-    pstride[1] = api->getStride(prev[1], plane);
+    pstride[1] = static_cast<int>(api->getStride(prev[1], plane));
     nextp[0] = api->getReadPtr(next[0], plane);
-    nstride[0] = api->getStride(next[0], plane);
+    nstride[0] = static_cast<int>(api->getStride(next[0], plane));
     if (STRENGTH > 1) {
         nextp[1] = api->getReadPtr(next[1], plane);
-        nstride[1] = api->getStride(next[1], plane);
+        nstride[1] = static_cast<int>(api->getStride(next[1], plane));
         if (STRENGTH > 2) {
             prevp[2] = api->getReadPtr(prev[2], plane);
-            pstride[2] = api->getStride(prev[2], plane);
+            pstride[2] = static_cast<int>(api->getStride(prev[2], plane));
             nextp[2] = api->getReadPtr(next[2], plane);
-            nstride[2] = api->getStride(next[2], plane);
+            nstride[2] = static_cast<int>(api->getStride(next[2], plane));
         }
     }
 }
 
 
-static proc_filter_t
-get_main_proc(arch_t arch, int strength, bool aggressive, int bits_per_sample)
+/*
+ * Whether a plane suits the ACCESS_ALIGNED kernels: every row starts on an
+ * align byte boundary and is followed by padding up to the next one.
+ * Frames which are views into other buffers may be neither.
+ */
+static bool
+is_aligned_plane(const void* p, int stride, size_t row_bytes, size_t align)
+noexcept
 {
-    using std::make_tuple;
+    const size_t padded = (row_bytes + align - 1) / align * align;
+    return reinterpret_cast<uintptr_t>(p) % align == 0 && stride > 0
+        && static_cast<size_t>(stride) % align == 0
+        && static_cast<size_t>(stride) >= padded;
+}
 
-    std::map<std::tuple<arch_t, int, bool, int>, proc_filter_t> table;
 
-    table[make_tuple(NO_SIMD, 1, false, 8)] =  proc_c<uint8_t, int, 1>;
-    table[make_tuple(NO_SIMD, 1, false, 16)] = proc_c<uint16_t, int, 1>;
-    table[make_tuple(NO_SIMD, 1, false, 32)] = proc_c<float, float, 1>;
+static uint64_t get_time_ns() noexcept
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
 
-    table[make_tuple(NO_SIMD, 2, false, 8)] =  proc_c<uint8_t, int, 2>;
-    table[make_tuple(NO_SIMD, 2, false, 16)] = proc_c<uint16_t, int, 2>;
-    table[make_tuple(NO_SIMD, 2, false, 32)] = proc_c<float, float, 2>;
 
-    table[make_tuple(NO_SIMD, 3, false, 8)] =  proc_c<uint8_t, int, 3>;
-    table[make_tuple(NO_SIMD, 3, false, 16)] = proc_c<uint16_t, int, 3>;
-    table[make_tuple(NO_SIMD, 3, false, 32)] = proc_c<float, float, 3>;
+// the frameData of n, from arInitial until n is returned or has failed.
+struct frame_data_t {
+    // the scenechange progress, or else the probe of fetchOrder.
+    intptr_t state;
+    // when n was requested, for stats=1.
+    uint64_t requested;
+};
 
-    table[make_tuple(NO_SIMD, 1, true, 8)] =  proc_a_c<uint8_t, int, 1>;
-    table[make_tuple(NO_SIMD, 1, true, 16)] = proc_a_c<uint16_t, int, 1>;
-    table[make_tuple(NO_SIMD, 1, true, 32)] = proc_a_c<float, float, 1>;
 
-    table[make_tuple(NO_SIMD, 2, true, 8)] =  proc_a_c<uint8_t, int, 2>;
-    table[make_tuple(NO_SIMD, 2, true, 16)] = proc_a_c<uint16_t, int, 2>;
-    table[make_tuple(NO_SIMD, 2, true, 32)] = proc_a_c<float, float, 2>;
+/*
+ * e.g. "proc_a_simd<uint16_t, 3>/avx2/stream". bits_per_sample must be the
+ * value the kernel was looked up with.
+ */
+static std::string
+get_kernel_name(arch_t arch, int strength, bool aggressive, int bits_per_sample,
+                bool skipstatic, const char* store)
+{
+    static const char* arch_names[] = {
+        "c", "sse2", "ssse3", "sse41", "avx2", "avx512"
+    };
+    arch = get_proc_arch(arch, bits_per_sample);
+    if (arch == NO_SIMD && bits_per_sample == 10) {
+        bits_per_sample = 16;
+    }
 
-    table[make_tuple(NO_SIMD, 3, true, 8)] =  proc_a_c<uint8_t, int, 3>;
-    table[make_tuple(NO_SIMD, 3, true, 16)] = proc_a_c<uint16_t, int, 3>;
-    table[make_tuple(NO_SIMD, 3, true, 32)] = proc_a_c<float, float, 3>;
+    std::string name = aggressive ? "proc_a_" : "proc_";
+    name += arch == NO_SIMD ? "c<" : "simd<";
+    name += bits_per_sample == 8 ? "uint8_t"
+        : bits_per_sample == 10 ? "int16_t"
+        : bits_per_sample == 16 ? "uint16_t" : "float";
+    name += ", " + std::to_string(strength) + ">";
+    if (skipstatic) {
+        name = "proc_s(" + name + ")";
+    }
+    name = name + "/" + arch_names[arch];
+    return arch == NO_SIMD ? name : name + "/" + store;
+}
 
-#if defined(__SSE2__)
-    table[make_tuple(USE_SSE2, 1, false, 8)]  = proc_simd<uint8_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 1, false, 10)] = proc_simd<int16_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 1, false, 16)] = proc_simd<uint16_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 1, false, 32)] = proc_simd<float, __m128, 1, USE_SSE2>;
-
-    table[make_tuple(USE_SSE2, 2, false, 8)]  = proc_simd<uint8_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 2, false, 10)] = proc_simd<int16_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 2, false, 16)] = proc_simd<uint16_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 2, false, 32)] = proc_simd<float, __m128, 2, USE_SSE2>;
-
-    table[make_tuple(USE_SSE2, 3, false, 8)]  = proc_simd<uint8_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 3, false, 10)] = proc_simd<int16_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 3, false, 16)] = proc_simd<uint16_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 3, false, 32)] = proc_simd<float, __m128, 3, USE_SSE2>;
-
-    table[make_tuple(USE_SSE2, 1, true, 8)]  = proc_a_simd<uint8_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 1, true, 10)] = proc_a_simd<int16_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 1, true, 16)] = proc_a_simd<uint16_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 1, true, 32)] = proc_a_simd<float, __m128, 1, USE_SSE2>;
-
-    table[make_tuple(USE_SSE2, 2, true, 8)]  = proc_a_simd<uint8_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 2, true, 10)] = proc_a_simd<int16_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 2, true, 16)] = proc_a_simd<uint16_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 2, true, 32)] = proc_a_simd<float, __m128, 2, USE_SSE2>;
-
-    table[make_tuple(USE_SSE2, 3, true, 8)]  = proc_a_simd<uint8_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 3, true, 10)] = proc_a_simd<int16_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 3, true, 16)] = proc_a_simd<uint16_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE2, 3, true, 32)] = proc_a_simd<float, __m128, 3, USE_SSE2>;
-
-#if defined(__SSE4_1__)
-    table[make_tuple(USE_SSE41, 1, false, 8)]  = proc_simd<uint8_t, __m128i, 1, USE_SSE2>;
-    table[make_tuple(USE_SSE41, 1, false, 16)] = proc_simd<uint16_t, __m128i, 1, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 1, false, 32)] = proc_simd<float, __m128, 1, USE_SSE2>;
-
-    table[make_tuple(USE_SSE41, 2, false, 8)]  = proc_simd<uint8_t, __m128i, 2, USE_SSE2>;
-    table[make_tuple(USE_SSE41, 2, false, 16)] = proc_simd<uint16_t, __m128i, 2, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 2, false, 32)] = proc_simd<float, __m128, 2, USE_SSE2>;
-
-    table[make_tuple(USE_SSE41, 3, false, 8)]  = proc_simd<uint8_t, __m128i, 3, USE_SSE2>;
-    table[make_tuple(USE_SSE41, 3, false, 16)] = proc_simd<uint16_t, __m128i, 3, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 3, false, 32)] = proc_simd<float, __m128, 3, USE_SSE2>;
-
-    table[make_tuple(USE_SSE41, 1, true, 8)]  = proc_a_simd<uint8_t, __m128i, 1, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 1, true, 16)] = proc_a_simd<uint16_t, __m128i, 1, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 1, true, 32)] = proc_a_simd<float, __m128, 1, USE_SSE41>;
-
-    table[make_tuple(USE_SSE41, 2, true, 8)]  = proc_a_simd<uint8_t, __m128i, 2, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 2, true, 16)] = proc_a_simd<uint16_t, __m128i, 2, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 2, true, 32)] = proc_a_simd<float, __m128, 2, USE_SSE41>;
-
-    table[make_tuple(USE_SSE41, 3, true, 8)]  = proc_a_simd<uint8_t, __m128i, 3, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 3, true, 16)] = proc_a_simd<uint16_t, __m128i, 3, USE_SSE41>;
-    table[make_tuple(USE_SSE41, 3, true, 32)] = proc_a_simd<float, __m128, 3, USE_SSE41>;
-
-#if defined(__AVX2__)
-    table[make_tuple(USE_AVX2, 1, false, 8)]  = proc_simd<uint8_t, __m256i, 1, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 1, false, 16)] = proc_simd<uint16_t, __m256i, 1, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 1, false, 32)] = proc_simd<float, __m128, 1, USE_AVX2>;
-
-    table[make_tuple(USE_AVX2, 2, false, 8)]  = proc_simd<uint8_t, __m256i, 2, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 2, false, 16)] = proc_simd<uint16_t, __m256i, 2, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 2, false, 32)] = proc_simd<float, __m128, 2, USE_AVX2>;
-
-    table[make_tuple(USE_AVX2, 3, false, 8)]  = proc_simd<uint8_t, __m256i, 3, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 3, false, 16)] = proc_simd<uint16_t, __m256i, 3, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 3, false, 32)] = proc_simd<float, __m256, 3, USE_AVX2>;
-
-    table[make_tuple(USE_AVX2, 1, true, 8)]  = proc_a_simd<uint8_t, __m256i, 1, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 1, true, 16)] = proc_a_simd<uint16_t, __m256i, 1, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 1, true, 32)] = proc_a_simd<float, __m256, 1, USE_AVX2>;
-
-    table[make_tuple(USE_AVX2, 2, true, 8)]  = proc_a_simd<uint8_t, __m256i, 2, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 2, true, 16)] = proc_a_simd<uint16_t, __m256i, 2, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 2, true, 32)] = proc_a_simd<float, __m256, 2, USE_AVX2>;
-
-    table[make_tuple(USE_AVX2, 3, true, 8)]  = proc_a_simd<uint8_t, __m256i, 3, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 3, true, 16)] = proc_a_simd<uint16_t, __m256i, 3, USE_AVX2>;
-    table[make_tuple(USE_AVX2, 3, true, 32)] = proc_a_simd<float, __m256, 3, USE_AVX2>;
+
+// curr and every neighbor one output frame reads.
+static int get_num_sources(int strength)
+{
+    return 1 + (strength > 2 ? 3 : 2) + strength;
+}
+
+
+/*
+ * store=0. Regular stores are used when everything one plane of a frame
+ * touches fits in half of the last level cache, so that its output is
+ * still there for the next filter. Half, because other frames are being
+ * processed at the same time.
+ */
+static store_t get_auto_store(size_t plane_bytes, int strength)
+{
+#if defined(INTEL_X86_CPU)
+    static const size_t llc = get_llc_size();
+#else
+    const size_t llc = 0;
 #endif
+    const size_t touched = plane_bytes * (get_num_sources(strength) + 1);
+    return touched <= llc / 2 ? STORE_TEMPORAL : STORE_STREAM;
+}
+
+
+/*
+ * Luma rows of one band. A band covers every processed plane and every
+ * output of a lookahead block, and the band being computed plus the next one
+ * fit in the L2 cache. 0 if the whole frame fits (or the L2 size is unknown
+ * and outputs is 1), then a stripe is not split.
+ */
+static int get_band_height(const VSVideoInfo& vi, const int* planes,
+                           int strength, int outputs)
+{
+#if defined(INTEL_X86_CPU)
+    size_t l2 = get_l2_size();
+#else
+    size_t l2 = 0;
 #endif
+    if (l2 == 0 && outputs > 1) {
+        l2 = 256 * 1024;
+    }
+    // the outputs of a block share all but outputs - 1 of their sources.
+    const size_t frames = get_num_sources(strength) + outputs * 2 - 1;
+    const VSVideoFormat& fmt = vi.format;
+    size_t row_bytes = 0;
+    for (int p = 0; p < fmt.numPlanes; ++p) {
+        if (planes[p] == 0) {
+            continue;
+        }
+        const int w = p == 0 ? vi.width : vi.width >> fmt.subSamplingW;
+        size_t bytes = static_cast<size_t>(w) * fmt.bytesPerSample * frames;
+        row_bytes += p == 0 ? bytes : bytes >> fmt.subSamplingH;
+    }
+    if (l2 == 0 || row_bytes == 0) {
+        return 0;
+    }
+    const size_t align = size_t(1) << fmt.subSamplingH;
+    size_t rows = std::max(l2 / 2 / row_bytes & ~(align - 1), align);
+    return rows < static_cast<size_t>(vi.height) ? static_cast<int>(rows) : 0;
+}
+
+
+static void
+prefetch_rows(const uint8_t* p, int stride, size_t rows, size_t row_bytes)
+{
+#if defined(__SSE2__)
+    for (size_t y = 0; y < rows; ++y) {
+        for (size_t x = 0; x < row_bytes; x += 64) {
+            _mm_prefetch(reinterpret_cast<const char*>(p + x), _MM_HINT_T1);
+        }
+        p += stride;
+    }
+#else
+    (void)p, (void)stride, (void)rows, (void)row_bytes;
 #endif
+}
 
-    return table[make_tuple(arch, strength, aggressive, bits_per_sample)];
 
+// the sample size the kernels of arch are looked up with.
+static int get_kernel_bits(const VSVideoFormat& fmt, arch_t arch)
+{
+    int bps = fmt.bitsPerSample;
+    if (bps > 8 && bps < 32) {
+        bps = bps <= 10 ? 10 : 16;
+    }
+    if (arch != USE_SSE2 && bps == 10) {
+        bps = 16;
+    }
+    return bps;
 }
 
+
+/*
+ * opt=-1. Every instruction set the cpu has is timed on synthetic planes of
+ * the clip's luma size and format. Then, with the fastest one, streaming
+ * and regular stores are timed with a read of the output after each call,
+ * as the next filter would do. Last, with a pool, some stripe heights.
+ * Each candidate scores the median of five calls after a warm-up call.
+ * The prefetch distance is the user's, it is not tuned.
+ */
+static tune_result_t
+run_autotune(const VSVideoInfo& vi, int strength, bool aggressive,
+             int prefetch, ThreadPool* pool, int stripe_height)
+{
+    const VSVideoFormat& fmt = vi.format;
+    const size_t width = vi.width, height = vi.height;
+    const int stride = (vi.width * fmt.bytesPerSample + 63) & ~63;
+    const size_t size = static_cast<size_t>(stride) * height;
+
+    // curr, three prev, three next and dst. neighbors differ by a small noise.
+    std::vector<uint8_t> buff(size * 8 + 64);
+    uint8_t* base = reinterpret_cast<uint8_t*>(
+        (reinterpret_cast<uintptr_t>(buff.data()) + 63) & ~uintptr_t(63));
+    uint32_t seed = 1;
+    for (int i = 0; i < 7; ++i) {
+        uint8_t* plane = base + size * i;
+        for (size_t y = 0; y < height; ++y) {
+            uint8_t* row = plane + stride * y;
+            for (size_t x = 0; x < width; ++x) {
+                seed = seed * 1103515245 + 12345;
+                int v = static_cast<int>((x >> 3) * 37 + (y >> 3) * 101) & 0xFF;
+                v = std::min(std::max(v + static_cast<int>(seed >> 28) - 8, 0), 255);
+                if (fmt.bytesPerSample == 1) {
+                    row[x] = static_cast<uint8_t>(v);
+                } else if (fmt.bytesPerSample == 2) {
+                    reinterpret_cast<uint16_t*>(row)[x] =
+                        static_cast<uint16_t>(v << (fmt.bitsPerSample - 8));
+                } else {
+                    reinterpret_cast<float*>(row)[x] = v / 255.0f;
+                }
+            }
+        }
+    }
+    const uint8_t* currp = base;
+    const uint8_t* prevp[] = {base + size, base + size * 2, base + size * 3};
+    const uint8_t* nextp[] = {base + size * 4, base + size * 5, base + size * 6};
+    uint8_t* dstp = base + size * 7;
+
+    auto run_stripe = [&](proc_filter_t proc, size_t top, size_t rows) {
+        const uint8_t* pp[3];
+        const uint8_t* np[3];
+        int pstride[3], nstride[3];
+        for (int j = 0; j < 3; ++j) {
+            pp[j] = prevp[j] + top * stride;
+            np[j] = nextp[j] + top * stride;
+            pstride[j] = nstride[j] = stride;
+        }
+        proc(dstp + top * stride, currp + top * stride, pp, np, stride, stride,
+             pstride, nstride, width, rows);
+    };
+
+    auto measure = [](const std::function<void()>& call) {
+        using clock = std::chrono::steady_clock;
+        call();
+        double ns[5];
+        for (auto& t : ns) {
+            auto t0 = clock::now();
+            call();
+            t = std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+        }
+        std::sort(ns, ns + 5);
+        return ns[2];
+    };
+
+    tune_result_t best = {NO_SIMD, stripe_height, STORE_STREAM};
+    double best_ns = 0.0;
+    arch_t prev_arch = USE_AVX512;
+    for (int opt = 0; opt <= 4; ++opt) {
+        arch_t arch = get_arch(opt);
+        if (opt > 0 && arch == prev_arch) {
+            continue;
+        }
+        prev_arch = arch;
+        proc_filter_t proc = get_main_proc(arch, strength, aggressive,
+                                           get_kernel_bits(fmt, arch),
+                                           STORE_STREAM, prefetch,
+                                           ACCESS_ALIGNED);
+        double ns = measure([&]() { run_stripe(proc, 0, height); });
+        if (opt == 0 || ns < best_ns) {
+            best.arch = arch;
+            best_ns = ns;
+        }
+    }
+
+    const int bits = get_kernel_bits(fmt, best.arch);
+    if (best.arch != NO_SIMD) {
+        volatile uint64_t sink = 0;
+        best_ns = 0.0;
+        for (store_t store : {STORE_STREAM, STORE_TEMPORAL}) {
+            proc_filter_t proc = get_main_proc(best.arch, strength, aggressive,
+                                               bits, store, prefetch,
+                                               ACCESS_ALIGNED);
+            double ns = measure([&]() {
+                run_stripe(proc, 0, height);
+                uint64_t sum = 0;
+                for (size_t i = 0; i < size; i += 8) {
+                    uint64_t v;
+                    memcpy(&v, dstp + i, 8);
+                    sum += v;
+                }
+                sink = sink + sum;
+            });
+            if (best_ns == 0.0 || ns < best_ns) {
+                best.store = store;
+                best_ns = ns;
+            }
+        }
+    }
+
+    if (!pool) {
+        return best;
+    }
+
+    proc_filter_t proc = get_main_proc(best.arch, strength, aggressive, bits,
+                                       best.store, prefetch, ACCESS_ALIGNED);
+    const int candidates[] = {stripe_height, 16, 32, 64, 128, 256};
+    best_ns = 0.0;
+    for (int c : candidates) {
+        if (c > static_cast<int>(height) || (c == stripe_height && best_ns > 0.0)) {
+            continue;
+        }
+        const size_t rows = c;
+        const size_t count = (height + rows - 1) / rows;
+        double ns = measure([&]() {
+            pool->run(count, [&](size_t i) {
+                run_stripe(proc, i * rows, std::min(rows, height - i * rows));
+            });
+        });
+        if (best_ns == 0.0 || ns < best_ns) {
+            best.stripeHeight = c;
+            best_ns = ns;
+        }
+    }
+    return best;
+}
+
+
 ReduceFlicker::
-ReduceFlicker(VSNodeRef* c, int s, bool aggressive, int* planes, arch_t arch,
-              VSCore* core, const VSAPI* api) :
-    strength(s), clip(c)
+ReduceFlicker(VSNode* c, int s, bool aggressive, int* planes, arch_t arch,
+              bool autotune, int store, int prefetch, bool bands,
+              int lookahead_frames, bool skipstatic,
+              bool scenechange, bool stats, int threads, int order,
+              VSNode** prev, VSNode** next, VSCore* core, const VSAPI* api) :
+    strength(s), mainProc(), staticProc(), procAlign(1),
+    pool(nullptr), stripeHeight(0), bandHeight(0), prefetchBands(bands),
+    frameStats(nullptr), fetchOrder(nullptr), clip(c),
+    sceneChange(scenechange), lookahead(nullptr)
 {
     vi = *api->getVideoInfo(clip);
     validate(!is_constant_format(vi), "clip is not constant format.");
     validate(is_half_precision(vi), "half precision is not supported.");
     
     memcpy(procType, planes, sizeof(int) * 3);
+    memcpy(prevClips, prev, sizeof(VSNode*) * 3);
+    memcpy(nextClips, next, sizeof(VSNode*) * 3);
+    for (int i = 0; i < 3; ++i) {
+        for (VSNode* node : {prevClips[i], nextClips[i]}) {
+            validate(node && !is_same_video_info(vi, *api->getVideoInfo(node)),
+                     "prev and next must have the same format, dimensions "
+                     "and length as clip.");
+        }
+    }
 
     switch (strength) {
     case 1:
@@ -242,62 +564,489 @@ ReduceFlicker(VSNodeRef* c, int s, bool aggressive, int* planes, arch_t arch,
         prepareSrcPtrs = prepare_pointers<3>;
     }
 
-    int bps = vi.format->bitsPerSample == 9 ? 10 : vi.format->bitsPerSample;
-    if (arch != USE_SSE2 && bps == 10) {
-        bps = 16;
+    // order=0 starts in ascending order, so that a source which decodes
+    // linearly does not have to seek back within the window.
+    fetchOrder = new FetchOrder(order == 2 ? ORDER_DESCENDING : ORDER_ASCENDING,
+                                order == 0);
+
+    if (threads == 0) {
+        threads = get_num_threads(core, api);
+    }
+    if (threads > 1) {
+        // two stripes per thread, so that a thread that finishes early can
+        // take another one. stripeHeight is in luma rows.
+        stripeHeight = std::max((vi.height + threads * 2 - 1) / (threads * 2), 16);
+        pool = new ThreadPool(threads - 1);
+    }
+
+    store_t stores[3];
+    for (int p = 0; p < vi.format.numPlanes; ++p) {
+        const int w = p == 0 ? vi.width : vi.width >> vi.format.subSamplingW;
+        const int h = p == 0 ? vi.height : vi.height >> vi.format.subSamplingH;
+        const size_t bytes = static_cast<size_t>(w) * h * vi.format.bytesPerSample;
+        stores[p] = store == 1 ? STORE_STREAM
+                  : store == 2 ? STORE_TEMPORAL : get_auto_store(bytes, strength);
+    }
+
+    if (autotune) {
+        tune_result_t tuned;
+        const std::string key = get_tune_key(vi, strength, aggressive,
+                                             prefetch, threads);
+        if (!load_tune_result(key, tuned)) {
+            tuned = run_autotune(vi, strength, aggressive, prefetch, pool,
+                                 stripeHeight);
+            save_tune_result(key, tuned);
+        }
+        arch = tuned.arch;
+        if (pool) {
+            stripeHeight = std::min(std::max(tuned.stripeHeight, 16),
+                                    vi.height);
+        }
+        if (store == 0) {
+            stores[0] = stores[1] = stores[2] = tuned.store;
+        }
+    }
+
+    const int bps = get_kernel_bits(vi.format, arch);
+
+    if (bands || lookahead_frames > 1) {
+        bandHeight = get_band_height(vi, procType, strength,
+                                     lookahead_frames);
+    }
+    if (lookahead_frames > 1) {
+        // a block per frame being rendered, and one to spare.
+        size_t capacity = get_num_threads(core, api) + 1;
+        lookahead = new LookaheadCache(lookahead_frames, vi.numFrames,
+                                       capacity, api);
+    }
+
+    procAlign = get_proc_align(get_proc_arch(arch, bps));
+    for (access_t a : {ACCESS_ALIGNED, ACCESS_UNALIGNED}) {
+        for (int p = 0; p < vi.format.numPlanes; ++p) {
+            mainProc[a][p] = get_main_proc(arch, strength, aggressive, bps,
+                                           stores[p], prefetch, a);
+        }
     }
 
-    mainProc = get_main_proc(arch, strength, aggressive, bps);
+    if (skipstatic) {
+        staticProc[ACCESS_ALIGNED] = get_static_proc(arch, strength, bps);
+        // the SIMD tile compares read whole aligned vectors, memcmp does not.
+        staticProc[ACCESS_UNALIGNED] = get_static_proc(NO_SIMD, strength, bps);
+    }
+
+    if (stats) {
+        // planes of different sizes may use different stores.
+        const char* storeName = stores[0] == STORE_STREAM ? "stream" : "temporal";
+        for (int p = 1; p < vi.format.numPlanes; ++p) {
+            if (stores[p] != stores[0]) {
+                storeName = "mixed";
+            }
+        }
+        kernelName = get_kernel_name(arch, strength, aggressive, bps,
+                                     skipstatic, storeName);
+        if (prefetch > 0 && strength > 1 && arch != NO_SIMD) {
+            kernelName += "/pf" + std::to_string(prefetch);
+        }
+        frameStats = new FrameStats();
+    }
+}
+
+
+ReduceFlicker::~ReduceFlicker()
+{
+    delete frameStats;
+    delete pool;
+    delete lookahead;
+    delete fetchOrder;
+}
+
+
+void ReduceFlicker::logStats(VSCore* core, const VSAPI* api)
+{
+    if (frameStats) {
+        api->logMessage(mtInformation, frameStats->summary(kernelName).c_str(),
+                        core);
+    }
+}
+
 
+bool ReduceFlicker::
+requestSceneFrames(int n, void** frameData, const VSAPI* api,
+                   VSFrameContext* ctx)
+{
+    auto data = reinterpret_cast<frame_data_t*>(*frameData);
+    if (!data) {
+        api->requestFrameFilter(n, clip, ctx);
+        *frameData = new frame_data_t{0, frameStats ? get_time_ns() : 0};
+        return false;
+    }
+
+    intptr_t prv = data->state & 0xF;
+    intptr_t nxt = (data->state >> SC_NEXT_SHIFT) & 0xF;
+    if (!(prv & SC_DONE)) {
+        prv = grow_scene_window(prv, n, -1, strength > 2 ? 3 : 2, 0, clip,
+                                api, ctx);
+    }
+    if (!(nxt & SC_DONE)) {
+        nxt = grow_scene_window(nxt, n, 1, strength, vi.numFrames - 1, clip,
+                                api, ctx);
+    }
+    data->state = prv | (nxt << SC_NEXT_SHIFT);
+    return (prv & SC_DONE) && (nxt & SC_DONE);
 }
 
 
 
-const VSFrameRef* ReduceFlicker::
-getFrame(int n, VSCore* core, const VSAPI* api, VSFrameContext* ctx)
+// lookahead > 1. The windows of every frame of the block of n.
+void ReduceFlicker::
+requestBlockFrames(int n, fetch_order_t order, const VSAPI* api,
+                   VSFrameContext* ctx)
 {
-    const int nf = vi.numFrames - 1;
-    const VSFrameRef *curr = nullptr, *prev[3], *next[3];
+    const int start = lookahead->getBlockStart(n);
+    const int end = start + lookahead->getBlockCount(start) - 1;
+    const int from = std::max(start - (strength > 2 ? 3 : 2), 0);
+    const int to = std::min(end + strength, vi.numFrames - 1);
+    request_range(from, to, order, clip, api, ctx);
+}
 
-    recieveFrames(&curr, prev, next, n, nf, clip, api, ctx);
 
-    const VSFormat* fmt = api->getFrameFormat(curr);
+/*
+ * The frames of n, or of its lookahead block. The probe of fetchOrder, if
+ * any, is kept in frameData until the frames have arrived.
+ */
+void ReduceFlicker::
+requestWindow(int n, void** frameData, const VSAPI* api, VSFrameContext* ctx)
+{
+    const uint64_t requested = frameStats ? get_time_ns() : 0;
+    int probe;
+    const fetch_order_t order = fetchOrder->begin(probe);
+    if (prevClips[0]) {
+        request_neighbor_frames(n, strength, order, clip, prevClips, nextClips,
+                                api, ctx);
+    } else if (lookahead) {
+        requestBlockFrames(n, order, api, ctx);
+    } else {
+        requestFrames(n, vi.numFrames - 1, order, clip, api, ctx);
+    }
+    *frameData = new frame_data_t{probe, requested};
+}
 
-    VSFrameRef* dst = api->newVideoFrame(fmt, vi.width, vi.height, curr, core);
 
-    for (int p = 0; p < fmt->numPlanes; ++p) {
-        if (procType[p] == 0) {
-            bitblt(api->getWritePtr(dst, p), api->getStride(dst, p),
-                   api->getReadPtr(curr, p), api->getStride(curr, p),
-                   get_row_size(dst, p, fmt, api), api->getFrameHeight(dst, p));
-            continue;
+void ReduceFlicker::windowReady(void* frameData, bool error)
+{
+    auto data = reinterpret_cast<frame_data_t*>(frameData);
+    const int probe = static_cast<int>(data->state);
+    if (error) {
+        fetchOrder->cancel(probe);
+    } else {
+        fetchOrder->end(probe);
+    }
+}
+
+
+void ReduceFlicker::freeFrameData(void** frameData)
+{
+    delete reinterpret_cast<frame_data_t*>(*frameData);
+    *frameData = nullptr;
+}
+
+
+const VSFrame* ReduceFlicker::
+getFrame(int n, const void* frameData, VSCore* core, const VSAPI* api,
+         VSFrameContext* ctx)
+{
+    TRACE_SCOPE("getFrame", n);
+
+    auto data = reinterpret_cast<const frame_data_t*>(frameData);
+    // from the request of the frames until the last of them was ready.
+    const uint64_t fetchNs = frameStats ? get_time_ns() - data->requested : 0;
+
+    const int last = vi.numFrames - 1;
+    if (lookahead) {
+        return lookahead->get(n, [&](int start, int num, const VSFrame** out) {
+            renderFrames(start, num, 0, last, fetchNs, out, core, api, ctx);
+        });
+    }
+
+    int first = 0, sceneLast = last;
+    if (sceneChange) {
+        const intptr_t state = data->state;
+        first = n - static_cast<int>(state & SC_COUNT);
+        sceneLast = n + static_cast<int>((state >> SC_NEXT_SHIFT) & SC_COUNT);
+        if (first == sceneLast) {
+            // n is a scene by itself. every frame of the window would be n,
+            // and the result would be n unchanged.
+            return api->getFrameFilter(n, clip, ctx);
         }
+    }
 
-        int cstride, pstride[3], nstride[3];
+    const VSFrame* dst;
+    renderFrames(n, 1, first, sceneLast, fetchNs, &dst, core, api, ctx);
+    return dst;
+}
+
+
+/*
+ * Renders the num output frames from start. Their windows are clamped to
+ * [first, last]. The outputs are processed together band by band, so a
+ * source row shared by several of them is read from memory once.
+ * fetchNs is the wait for their source frames, for stats=1.
+ */
+void ReduceFlicker::
+renderFrames(int start, int num, int first, int last, uint64_t fetchNs,
+             const VSFrame** result, VSCore* core, const VSAPI* api,
+             VSFrameContext* ctx)
+{
+    struct plane_t {
         const uint8_t *currp, *prevp[3], *nextp[3];
-        prepareSrcPtrs(&currp, prevp, nextp, cstride, pstride, nstride, curr,
-                       prev, next, p, api);
+        int cstride, pstride[3], nstride[3];
+        uint8_t* dstp;
+        int dstride;
+        size_t width, height;
+        access_t access;
+    };
+
+    struct output_t {
+        int n;
+        const VSFrame *curr, *prev[3], *next[3];
+        VSFrame* dst;
+        plane_t planes[3];
+        // nominal traffic of the kernel, for stats=1.
+        int64_t bytesRead[3], bytesWritten[3];
+    };
+    std::vector<output_t> outputs(num);
+
+    for (int o = 0; o < num; ++o) {
+        output_t& out = outputs[o];
+        out.n = start + o;
+        TRACE_SCOPE("recieveFrames", out.n);
+        if (prevClips[0]) {
+            recieve_neighbor_frames(&out.curr, out.prev, out.next, out.n,
+                                    strength, clip, prevClips, nextClips, api,
+                                    ctx);
+        } else {
+            recieveFrames(&out.curr, out.prev, out.next, out.n, first, last,
+                          clip, api, ctx);
+        }
+    }
+    const VSVideoFormat* fmt = api->getVideoFrameFormat(outputs[0].curr);
+    const int numSrcs = get_num_sources(strength);
+
+    for (output_t& out : outputs) {
+        // unprocessed planes are shared with curr instead of being copied.
+        const VSFrame* planeSrc[3];
+        int srcPlanes[3];
+        for (int p = 0; p < fmt->numPlanes; ++p) {
+            planeSrc[p] = procType[p] == 0 ? out.curr : nullptr;
+            srcPlanes[p] = p;
+        }
+        out.dst = api->newVideoFrame2(fmt, vi.width, vi.height, planeSrc,
+                                      srcPlanes, out.curr, core);
 
-        uint8_t* dstp = api->getWritePtr(dst, p);
-        int dstride = api->getStride(dst, p);
-        size_t width = api->getFrameWidth(dst, p);
-        size_t height = api->getFrameHeight(dst, p);
+        for (int p = 0; p < fmt->numPlanes; ++p) {
+            out.bytesRead[p] = out.bytesWritten[p] = 0;
+            if (procType[p] == 0) {
+                // getWritePtr() would make the core copy the shared plane.
+                continue;
+            }
+            plane_t& pl = out.planes[p];
+            pl.dstp = api->getWritePtr(out.dst, p);
+            pl.dstride = static_cast<int>(api->getStride(out.dst, p));
+            pl.width = api->getFrameWidth(out.dst, p);
+            pl.height = api->getFrameHeight(out.dst, p);
+            out.bytesWritten[p] = pl.width * fmt->bytesPerSample * pl.height;
+            out.bytesRead[p] = out.bytesWritten[p] * numSrcs;
+            prepareSrcPtrs(&pl.currp, pl.prevp, pl.nextp, pl.cstride,
+                           pl.pstride, pl.nstride, out.curr, out.prev,
+                           out.next, p, api);
 
-        mainProc(dstp, currp, prevp, nextp, dstride, cstride, pstride, nstride,
-                 width, height);
+            const size_t row_bytes = pl.width * fmt->bytesPerSample;
+            bool aligned = is_aligned_plane(pl.dstp, pl.dstride, row_bytes,
+                                            procAlign)
+                && is_aligned_plane(pl.currp, pl.cstride, row_bytes, procAlign);
+            for (int j = 0; j < (strength > 2 ? 3 : 2); ++j) {
+                aligned = aligned && is_aligned_plane(pl.prevp[j], pl.pstride[j],
+                                                      row_bytes, procAlign);
+            }
+            for (int j = 0; j < strength; ++j) {
+                aligned = aligned && is_aligned_plane(pl.nextp[j], pl.nstride[j],
+                                                      row_bytes, procAlign);
+            }
+            pl.access = aligned ? ACCESS_ALIGNED : ACCESS_UNALIGNED;
+        }
     }
 
-    api->freeFrame(curr);
-    api->freeFrame(prev[0]);
-    api->freeFrame(prev[1]);
-    api->freeFrame(next[0]);
-    if (strength > 1) {
-        api->freeFrame(next[1]);
+    // in luma rows. a stripe covers every processed plane and output.
+    struct stripe_t {
+        size_t top;
+        size_t rows;
+    };
+    std::vector<stripe_t> stripes;
+
+    const size_t height = vi.height;
+    const size_t rows = pool ? stripeHeight : height;
+    for (size_t top = 0; top < height; top += rows) {
+        stripes.push_back({top, std::min(rows, height - top)});
     }
-    if (strength > 2) {
-        api->freeFrame(prev[2]);
-        api->freeFrame(next[2]);
+
+    // per stripe and output.
+    std::vector<size_t> skipped(stripes.size() * num, 0);
+
+    // luma row y of plane p. the last row maps to the end of the plane.
+    auto plane_row = [&](int p, size_t y) {
+        return p == 0 ? y : y == height ? outputs[0].planes[p].height
+                                        : y >> fmt->subSamplingH;
+    };
+
+    auto prefetch = [&](const plane_t& pl, size_t top, size_t count) {
+        const size_t row_bytes = pl.width * fmt->bytesPerSample;
+        prefetch_rows(pl.currp + top * pl.cstride, pl.cstride, count, row_bytes);
+        for (int j = 0; j < (strength > 2 ? 3 : 2); ++j) {
+            prefetch_rows(pl.prevp[j] + top * pl.pstride[j], pl.pstride[j],
+                          count, row_bytes);
+        }
+        for (int j = 0; j < strength; ++j) {
+            prefetch_rows(pl.nextp[j] + top * pl.nstride[j], pl.nstride[j],
+                          count, row_bytes);
+        }
+    };
+
+    auto proc_rows = [&](size_t& skip, const plane_t& pl, int p, size_t top,
+                         size_t count) {
+        uint8_t* dstp = pl.dstp + top * pl.dstride;
+        const uint8_t* currp = pl.currp + top * pl.cstride;
+
+        // the kernels may modify the stride arrays, so each stripe gets
+        // its own copies.
+        const uint8_t *prevp[3], *nextp[3];
+        int pstride[3], nstride[3];
+        for (int j = 0; j < 3; ++j) {
+            if (j < (strength > 2 ? 3 : 2)) {
+                prevp[j] = pl.prevp[j] + top * pl.pstride[j];
+                pstride[j] = pl.pstride[j];
+            }
+            if (j < strength) {
+                nextp[j] = pl.nextp[j] + top * pl.nstride[j];
+                nstride[j] = pl.nstride[j];
+            }
+        }
+
+        const access_t a = pl.access;
+        if (staticProc[a]) {
+            skip += staticProc[a](mainProc[a][p], dstp, currp, prevp, nextp,
+                                  pl.dstride, pl.cstride, pstride, nstride,
+                                  pl.width, count);
+            return;
+        }
+
+        mainProc[a][p](dstp, currp, prevp, nextp, pl.dstride, pl.cstride,
+                       pstride, nstride, pl.width, count);
+    };
+
+    /*
+     * A stripe is walked in bands of bandHeight rows. Each band is
+     * processed for all planes and outputs, in four parts per plane. With
+     * bands=1, before each part the matching part of the next band is
+     * prefetched into L2, so it is loaded while this one is computed.
+     */
+    auto proc_stripe = [&](size_t i) {
+        const stripe_t& s = stripes[i];
+        const size_t end = s.top + s.rows;
+        const size_t band = bandHeight > 0 ? bandHeight : s.rows;
+        for (size_t top = s.top; top < end; top += band) {
+            const size_t bottom = std::min(top + band, end);
+            const size_t next_bottom = prefetchBands
+                ? std::min(bottom + band, end) : bottom;
+            for (int p = 0; p < fmt->numPlanes; ++p) {
+                if (procType[p] == 0) {
+                    continue;
+                }
+                const size_t ptop = plane_row(p, top);
+                const size_t count = plane_row(p, bottom) - ptop;
+                const size_t next = plane_row(p, next_bottom) - ptop - count;
+                if (count == 0) {
+                    continue;
+                }
+                for (int o = 0; o < num; ++o) {
+                    TRACE_SCOPE("mainProc", outputs[o].n, p);
+                    const plane_t& pl = outputs[o].planes[p];
+                    size_t& skip = skipped[i * num + o];
+                    if (next == 0) {
+                        proc_rows(skip, pl, p, ptop, count);
+                        continue;
+                    }
+                    const size_t part = (count + 3) / 4;
+                    const size_t parts = (count + part - 1) / part;
+                    const size_t next_part = (next + parts - 1) / parts;
+                    for (size_t k = 0; k < parts; ++k) {
+                        const size_t y = k * part, ny = k * next_part;
+                        if (ny < next) {
+                            prefetch(pl, ptop + count + ny,
+                                     std::min(next_part, next - ny));
+                        }
+                        proc_rows(skip, pl, p, ptop + y,
+                                  std::min(part, count - y));
+                    }
+                }
+            }
+        }
+    };
+
+    const uint64_t kernelStart = frameStats ? get_time_ns() : 0;
+    if (pool) {
+        pool->run(stripes.size(), proc_stripe);
+    } else {
+        for (size_t i = 0; i < stripes.size(); ++i) {
+            proc_stripe(i);
+        }
     }
+    const uint64_t kernelNs = frameStats ? get_time_ns() - kernelStart : 0;
 
-    return dst;
+    for (int o = 0; o < num; ++o) {
+        output_t& out = outputs[o];
+
+        if (staticProc[ACCESS_ALIGNED]) {
+            int64_t tiles = 0;
+            for (size_t i = 0; i < stripes.size(); ++i) {
+                tiles += skipped[i * num + o];
+            }
+            api->mapSetInt(api->getFramePropertiesRW(out.dst),
+                           "_RdflStaticTiles", tiles, maReplace);
+        }
+
+        // the time of a block is shared evenly by its outputs.
+        if (frameStats) {
+            int64_t read = 0, written = 0;
+            for (int p = 0; p < fmt->numPlanes; ++p) {
+                read += out.bytesRead[p];
+                written += out.bytesWritten[p];
+            }
+            frameStats->add(kernelNs / num, fetchNs / num, read, written);
+
+            VSMap* props = api->getFramePropertiesRW(out.dst);
+            api->mapSetInt(props, "_RdflKernelNs", kernelNs / num, maReplace);
+            api->mapSetInt(props, "_RdflFetchNs", fetchNs / num, maReplace);
+            api->mapSetData(props, "_RdflKernelName", kernelName.c_str(),
+                            static_cast<int>(kernelName.size()), dtUtf8,
+                            maReplace);
+            api->mapSetIntArray(props, "_RdflBytesRead", out.bytesRead,
+                                fmt->numPlanes);
+            api->mapSetIntArray(props, "_RdflBytesWritten", out.bytesWritten,
+                                fmt->numPlanes);
+        }
+
+        api->freeFrame(out.curr);
+        api->freeFrame(out.prev[0]);
+        api->freeFrame(out.prev[1]);
+        api->freeFrame(out.next[0]);
+        if (strength > 1) {
+            api->freeFrame(out.next[1]);
+        }
+        if (strength > 2) {
+            api->freeFrame(out.prev[2]);
+            api->freeFrame(out.next[2]);
+        }
+
+        result[o] = out.dst;
+    }
 }
@@ -24,43 +24,74 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef VS_REDUCE_FLICKER_H
 #define VS_REDUCE_FLICKER_H
 
-#include <VapourSynth.h>
+#include <string>
+#include <VapourSynth4.h>
 #include "arch.h"
-
-
-typedef void (*proc_filter_t)(
-    uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
-    const uint8_t** nextp, int dstride, int cstride, int* pstride, int* nstride,
-    size_t width, size_t height);
+#include "fetch_order.h"
+#include "frame_stats.h"
+#include "get_proc.h"
+#include "lookahead_cache.h"
+#include "thread_pool.h"
 
 
 class ReduceFlicker {
     int strength;
     int procType[3];
 
+    void(*requestFrames)(
+        int n, int nf, fetch_order_t order, VSNode* clip, const VSAPI* api,
+        VSFrameContext* ctx);
     void(*recieveFrames)(
-        const VSFrameRef** curr, const VSFrameRef** prev,
-        const VSFrameRef** next, int n, int nf, VSNodeRef* clip,
+        const VSFrame** curr, const VSFrame** prev,
+        const VSFrame** next, int n, int first, int last, VSNode* clip,
         const VSAPI* api, VSFrameContext* ctx);
     void(*prepareSrcPtrs)(
         const uint8_t** currp, const uint8_t** prevp, const uint8_t** nextp,
-        int& cstride, int* pstride, int* nstride, const VSFrameRef* curr,
-        const VSFrameRef** prev, const VSFrameRef** next, int plane,
+        int& cstride, int* pstride, int* nstride, const VSFrame* curr,
+        const VSFrame** prev, const VSFrame** next, int plane,
         const VSAPI* api);
-    proc_filter_t mainProc;
+    // by access_t and plane. the access is chosen for each plane of a frame.
+    proc_filter_t mainProc[2][3];
+    proc_static_t staticProc[2];
+    size_t procAlign;
+    ThreadPool* pool;
+    int stripeHeight;
+    int bandHeight;
+    bool prefetchBands;
+    FrameStats* frameStats;
+    std::string kernelName;
+    FetchOrder* fetchOrder;
+
+    void renderFrames(int start, int num, int first, int last,
+                      uint64_t fetchNs, const VSFrame** result, VSCore* core,
+                      const VSAPI* api, VSFrameContext* ctx);
+    void requestBlockFrames(int n, fetch_order_t order, const VSAPI* api,
+                            VSFrameContext* ctx);
 
 public:
-    VSNodeRef* clip;
+    VSNode* clip;
+    // clips whose frame n is used as frame n - k - 1 / n + k + 1, or nullptr.
+    VSNode* prevClips[3];
+    VSNode* nextClips[3];
     VSVideoInfo vi;
-
-    void(*requestFrames)(
-        int n, int nf, VSNodeRef* clip, const VSAPI* api, VSFrameContext* ctx);
-
-    ReduceFlicker(VSNodeRef* clip, int strength, bool aggressive, int* planes,
-                  arch_t arch, VSCore* core, const VSAPI* api);
-    ~ReduceFlicker() {}
-    const VSFrameRef* getFrame(int n, VSCore* core, const VSAPI* api,
-                               VSFrameContext* ctx);
+    bool sceneChange;
+    LookaheadCache* lookahead;
+
+    ReduceFlicker(VSNode* clip, int strength, bool aggressive, int* planes,
+                  arch_t arch, bool autotune, int store, int prefetch,
+                  bool bands, int lookahead, bool skipstatic,
+                  bool scenechange, bool stats, int threads, int order,
+                  VSNode** prev, VSNode** next, VSCore* core, const VSAPI* api);
+    ~ReduceFlicker();
+    void logStats(VSCore* core, const VSAPI* api);
+    bool requestSceneFrames(int n, void** frameData, const VSAPI* api,
+                            VSFrameContext* ctx);
+    void requestWindow(int n, void** frameData, const VSAPI* api,
+                       VSFrameContext* ctx);
+    void windowReady(void* frameData, bool error);
+    void freeFrameData(void** frameData);
+    const VSFrame* getFrame(int n, const void* frameData, VSCore* core,
+                            const VSAPI* api, VSFrameContext* ctx);
 };
 
 #endif
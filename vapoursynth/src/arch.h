@@ -24,6 +24,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef ARCHITECTURE_H
 #define ARCHITECTURE_H
 
+#include <cstddef>
+
 #if defined(_M_IX86) || defined(_M_AMD64) || defined(__i686) || defined(__x86_64)
     #define INTEL_X86_CPU
 #if !defined(__GNUC__)
@@ -59,6 +61,7 @@ enum arch_t {
     USE_SSSE3,
     USE_SSE41,
     USE_AVX2,
+    USE_AVX512,
 };
 
 
@@ -67,33 +70,40 @@ enum arch_t {
     extern bool has_ssse3(void);
     extern bool has_sse41(void);
     extern bool has_avx2(void);
+    extern bool has_avx512bw(void);
+    // writes the 48 characters of the processor brand string and a '\0'.
+    extern void get_cpu_brand(char* brand);
+    // size of the largest data cache in bytes, or 0 if it is unknown.
+    extern size_t get_llc_size(void);
+    // size of the (per core) level 2 cache in bytes, or 0 if it is unknown.
+    extern size_t get_l2_size(void);
 #endif
 
 
+/*
+ * The kernels for each instruction set are built in their own translation
+ * units (proc_filter_*.cpp), so this only depends on what the cpu supports.
+ * get_main_proc() falls back if a unit was built without its instruction set.
+ */
 static inline arch_t get_arch(int opt)
 {
-#if !defined(__SSE2__)
-    return NO_SIMD
+#if !defined(INTEL_X86_CPU)
+    return NO_SIMD;
 #else
     if (opt == 0 || !has_sse2()) {
         return NO_SIMD;
     }
-#if !defined(__SSE4_1__)
-    return USE_SSE2;
-#else
     if (opt == 1 || !has_sse41()) {
         return USE_SSE2;
     }
-#if !defined(__AVX2__)
-    return USE_SSE41;
-#else
     if (opt == 2 || !has_avx2()) {
         return USE_SSE41;
     }
-    return USE_AVX2;
-#endif // __AVX2__
-#endif // __SSE4_1__
-#endif // __SSE2__
+    if (opt == 3 || !has_avx512bw()) {
+        return USE_AVX2;
+    }
+    return USE_AVX512;
+#endif // INTEL_X86_CPU
 }
 
 #endif //ARCHITECTURE_H
@@ -0,0 +1,174 @@
+/*
+autotune.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#if defined(_WIN32)
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+#include "autotune.h"
+
+
+// arch is stored as the opt value which selects it.
+static int arch_to_opt(arch_t arch)
+{
+    switch (arch) {
+    case USE_SSE2:
+        return 1;
+    case USE_SSE41:
+        return 2;
+    case USE_AVX2:
+        return 3;
+    case USE_AVX512:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+
+static void make_dir(const std::string& path)
+{
+#if defined(_WIN32)
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+
+// returns an empty string if there is no place for the file.
+static std::string get_cache_path(bool create)
+{
+#if defined(_WIN32)
+    const char* base = std::getenv("LOCALAPPDATA");
+    if (!base || !*base) {
+        return "";
+    }
+    std::string dir = std::string(base) + "\\ReduceFlicker";
+    if (create) {
+        make_dir(dir);
+    }
+    return dir + "\\autotune.txt";
+#else
+    std::string dir;
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+    if (xdg && *xdg) {
+        dir = xdg;
+    } else if (home && *home) {
+        dir = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    if (create) {
+        make_dir(dir);
+    }
+    dir += "/reduceflicker";
+    if (create) {
+        make_dir(dir);
+    }
+    return dir + "/autotune.txt";
+#endif
+}
+
+
+// several instances may be created at once by one script.
+static std::mutex file_mutex;
+
+
+std::string
+get_tune_key(const VSVideoInfo& vi, int strength, bool aggressive, int prefetch,
+             int threads)
+{
+    char brand[49] = "unknown";
+#if defined(INTEL_X86_CPU)
+    get_cpu_brand(brand);
+#endif
+    std::string cpu(brand);
+    cpu.erase(0, cpu.find_first_not_of(' '));
+
+    char buff[256];
+    snprintf(buff, sizeof(buff), "%s|%dx%d|%d:%d:%d:%d:%d|s%d|a%d|t%d|pf%d",
+             cpu.c_str(), vi.width, vi.height, vi.format.colorFamily,
+             vi.format.sampleType, vi.format.bitsPerSample,
+             vi.format.subSamplingW, vi.format.subSamplingH, strength,
+             aggressive ? 1 : 0, threads, prefetch);
+    return std::string(buff);
+}
+
+
+/*
+ * The file is only appended to, so the last line of a key wins.
+ */
+bool load_tune_result(const std::string& key, tune_result_t& result)
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    std::string path = get_cache_path(false);
+    FILE* fp = path.empty() ? nullptr : fopen(path.c_str(), "r");
+    if (!fp) {
+        return false;
+    }
+
+    bool found = false;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        std::string s(line);
+        size_t tab = s.find('\t');
+        if (tab == std::string::npos || s.compare(0, tab, key) != 0
+                || tab != key.size()) {
+            continue;
+        }
+        int opt, stripe, store;
+        if (sscanf(s.c_str() + tab + 1, "%d %d %d", &opt, &stripe, &store) != 3
+                || opt < 0 || opt > 4 || stripe < 1
+                || (store != STORE_STREAM && store != STORE_TEMPORAL)) {
+            continue;
+        }
+        // get_arch() also drops an instruction set the cpu does not have.
+        result.arch = get_arch(opt);
+        result.stripeHeight = stripe;
+        result.store = static_cast<store_t>(store);
+        found = true;
+    }
+    fclose(fp);
+    return found;
+}
+
+
+void save_tune_result(const std::string& key, const tune_result_t& result)
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    std::string path = get_cache_path(true);
+    FILE* fp = path.empty() ? nullptr : fopen(path.c_str(), "a");
+    if (!fp) {
+        return;
+    }
+    fprintf(fp, "%s\t%d %d %d\n", key.c_str(), arch_to_opt(result.arch),
+            result.stripeHeight, static_cast<int>(result.store));
+    fclose(fp);
+}
@@ -0,0 +1,54 @@
+/*
+autotune.h: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef REDUCE_FLICKER_AUTOTUNE_H
+#define REDUCE_FLICKER_AUTOTUNE_H
+
+#include <string>
+#include <VapourSynth4.h>
+#include "arch.h"
+#include "get_proc.h"
+
+
+/*
+ * Results of opt=-1 are kept in a small per-user text file
+ * ($XDG_CACHE_HOME/reduceflicker/autotune.txt, or
+ * %LOCALAPPDATA%\ReduceFlicker\autotune.txt on Windows), one line per key.
+ * The key holds the cpu model and everything the timing depends on, so a
+ * result is never used for another cpu or format.
+ */
+struct tune_result_t {
+    arch_t arch;
+    int stripeHeight;
+    store_t store;
+};
+
+std::string
+get_tune_key(const VSVideoInfo& vi, int strength, bool aggressive, int prefetch,
+             int threads);
+
+bool load_tune_result(const std::string& key, tune_result_t& result);
+
+void save_tune_result(const std::string& key, const tune_result_t& result);
+
+#endif
@@ -21,6 +21,7 @@
 #if defined(_M_IX86) || defined(_M_AMD64) || defined(__i686) || defined(__x86_64)
 
 #include <cstdint>
+#include <cstring>
 #if defined(__GNUC__)
     #include <cpuid.h>
 #else
@@ -71,6 +72,21 @@ static inline void get_cpuid2(int *array, int info_type, int ecx)
 #endif
 }
 
+
+// XCR0, the register state the OS saves on a context switch.
+// Only valid when CPUID.1:ECX.OSXSAVE[bit 27] is set.
+static inline uint64_t get_xcr0(void)
+{
+#if defined(__GNUC__)
+    uint32_t eax, edx;
+    // xgetbv, spelled out for assemblers that do not know the mnemonic.
+    __asm__ volatile(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#else
+    return _xgetbv(0);
+#endif
+}
+
 static uint32_t get_simd_support_info(void)
 {
     uint32_t ret = 0;
@@ -96,7 +112,17 @@ static uint32_t get_simd_support_info(void)
     if (is_bit_set(regs[2], 26)) {
         ret |= CPU_SSE4_2_SUPPORT;
     }
+    // the ymm and zmm registers are only usable if the OS saves them.
+    // XCR0 bits 1 and 2 are the xmm/ymm state, bits 5, 6 and 7 the
+    // opmask and zmm state.
+    bool os_ymm = false;
+    bool os_zmm = false;
     if (is_bit_set(regs[2], 27)) {
+        const uint64_t xcr0 = get_xcr0();
+        os_ymm = (xcr0 & 0x06) == 0x06;
+        os_zmm = (xcr0 & 0xE6) == 0xE6;
+    }
+    if (os_ymm) {
         if (is_bit_set(regs[2], 28)) {
             ret |= CPU_AVX_SUPPORT;
         }
@@ -120,10 +146,10 @@ static uint32_t get_simd_support_info(void)
     }
 
     get_cpuid2(regs, 0x00000007, 0);
-    if (is_bit_set(regs[1], 5)) {
+    if (os_ymm && is_bit_set(regs[1], 5)) {
         ret |= CPU_AVX2_SUPPORT;
     }
-    if (!is_bit_set(regs[1], 16)) {
+    if (!os_zmm || !is_bit_set(regs[1], 16)) {
         return ret;
     }
 
@@ -176,4 +202,77 @@ bool has_avx2(void)
     return (get_simd_support_info() & CPU_AVX2_SUPPORT) != 0;
 }
 
+bool has_avx512bw(void)
+{
+    const uint32_t flags = CPU_AVX512F_SUPPORT | CPU_AVX512BW_SUPPORT
+                         | CPU_AVX512VL_SUPPORT;
+    return (get_simd_support_info() & flags) == flags;
+}
+
+void get_cpu_brand(char* brand)
+{
+    int regs[12] = {0};
+    int info[4] = {0};
+    get_cpuid(info, 0x80000000);
+    if (static_cast<uint32_t>(info[0]) >= 0x80000004) {
+        for (int i = 0; i < 3; ++i) {
+            get_cpuid(regs + i * 4, 0x80000002 + i);
+        }
+    }
+    memcpy(brand, regs, 48);
+    brand[48] = '\0';
+}
+
+// level 0 is the largest data cache of any level.
+static size_t get_data_cache_size(int level)
+{
+    int regs[4] = {0};
+    size_t result = 0;
+
+    // deterministic cache parameters, leaf 4 on Intel and 0x8000001D on AMD.
+    auto scan = [&](int leaf) {
+        for (int i = 0; i < 16; ++i) {
+            get_cpuid2(regs, leaf, i);
+            const int type = regs[0] & 0x1F;
+            if (type == 0) {
+                break;
+            }
+            if (type == 2) {
+                continue; // instruction cache
+            }
+            if (level != 0 && ((regs[0] >> 5) & 0x7) != level) {
+                continue;
+            }
+            const size_t ways = ((regs[1] >> 22) & 0x3FF) + 1;
+            const size_t partitions = ((regs[1] >> 12) & 0x3FF) + 1;
+            const size_t line = (regs[1] & 0xFFF) + 1;
+            const size_t sets = static_cast<uint32_t>(regs[2]) + size_t(1);
+            const size_t size = ways * partitions * line * sets;
+            result = size > result ? size : result;
+        }
+    };
+
+    get_cpuid(regs, 0x00000000);
+    if (regs[0] >= 4) {
+        scan(4);
+    }
+    if (result == 0) {
+        get_cpuid(regs, 0x80000000);
+        if (static_cast<uint32_t>(regs[0]) >= 0x8000001D) {
+            scan(0x8000001D);
+        }
+    }
+    return result;
+}
+
+size_t get_llc_size(void)
+{
+    return get_data_cache_size(0);
+}
+
+size_t get_l2_size(void)
+{
+    return get_data_cache_size(2);
+}
+
 #endif
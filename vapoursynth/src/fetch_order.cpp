@@ -0,0 +1,128 @@
+/*
+fetch_order.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <algorithm>
+#include <chrono>
+#include "fetch_order.h"
+
+
+static uint64_t get_time_ns() noexcept
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+
+FetchOrder::FetchOrder(fetch_order_t pref, bool adaptive) :
+    chosen(adaptive ? -1 : pref), preferred(pref), started(0), finished(0),
+    inFlight(), startNs(), ns(), mixed()
+{
+}
+
+
+fetch_order_t FetchOrder::probeOrder(int probe) const
+{
+    const int phase = (probe - 1) * 4 / NUM_PROBES;
+    if (phase == 0 || phase == 3) {
+        return preferred;
+    }
+    return preferred == ORDER_ASCENDING ? ORDER_DESCENDING : ORDER_ASCENDING;
+}
+
+
+fetch_order_t FetchOrder::begin(int& probe)
+{
+    probe = 0;
+    const int c = chosen.load(std::memory_order_acquire);
+    if (c >= 0) {
+        return static_cast<fetch_order_t>(c);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    // the first window is not timed, nor those begun while the last probes
+    // are still being fetched.
+    if (started++ == 0 || started > NUM_PROBES + 1) {
+        return preferred;
+    }
+    probe = started - 1;
+    const fetch_order_t order = probeOrder(probe);
+    mixed[probe - 1] = inFlight[1 - order] > 0;
+    ++inFlight[order];
+    startNs[probe - 1] = get_time_ns();
+    return order;
+}
+
+
+void FetchOrder::end(int probe)
+{
+    if (probe > 0) {
+        finish(probe, get_time_ns());
+    }
+}
+
+
+void FetchOrder::cancel(int probe)
+{
+    if (probe > 0) {
+        finish(probe, 0);
+    }
+}
+
+
+void FetchOrder::finish(int probe, uint64_t now)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    const int order = probeOrder(probe);
+    --inFlight[order];
+    if (inFlight[1 - order] > 0) {
+        mixed[probe - 1] = true;
+    }
+    if (now > 0 && !mixed[probe - 1]) {
+        ns[probe - 1] = std::max<uint64_t>(now - startNs[probe - 1], 1);
+    }
+    if (++finished < NUM_PROBES) {
+        return;
+    }
+
+    // the median of each order, over the windows which are counted.
+    uint64_t median[2] = {0, 0};
+    for (int o = 0; o < 2; ++o) {
+        uint64_t t[NUM_PROBES];
+        int count = 0;
+        for (int i = 0; i < NUM_PROBES; ++i) {
+            if (ns[i] > 0 && probeOrder(i + 1) == o) {
+                t[count++] = ns[i];
+            }
+        }
+        if (count < 3) {
+            chosen.store(preferred, std::memory_order_release);
+            return;
+        }
+        std::sort(t, t + count);
+        median[o] = t[count / 2];
+    }
+    const int other = preferred == ORDER_ASCENDING ? 1 : 0;
+    const bool faster = median[other] * 10 < median[preferred] * 9;
+    chosen.store(faster ? other : preferred, std::memory_order_release);
+}
@@ -0,0 +1,106 @@
+/*
+frame_stats.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <cstdio>
+#include "frame_stats.h"
+
+
+static int get_bucket(uint64_t ns)
+{
+    int b = 0;
+    while (ns > 1 && b < FrameStats::NUM_BUCKETS - 1) {
+        ns >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+
+FrameStats::Histogram::Histogram() : total(0)
+{
+    for (auto& b : buckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+void FrameStats::Histogram::add(uint64_t ns)
+{
+    buckets[get_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(ns, std::memory_order_relaxed);
+}
+
+
+// returns the upper end of the bucket which holds the p-th sample.
+uint64_t FrameStats::Histogram::percentile(double p) const
+{
+    uint64_t count = 0;
+    for (const auto& b : buckets) {
+        count += b.load(std::memory_order_relaxed);
+    }
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return uint64_t(2) << i;
+        }
+    }
+    return 0;
+}
+
+
+FrameStats::FrameStats() : frames(0), bytesRead(0), bytesWritten(0) {}
+
+
+void FrameStats::
+add(uint64_t kernel_ns, uint64_t fetch_ns, uint64_t read, uint64_t written)
+{
+    frames.fetch_add(1, std::memory_order_relaxed);
+    bytesRead.fetch_add(read, std::memory_order_relaxed);
+    bytesWritten.fetch_add(written, std::memory_order_relaxed);
+    kernel.add(kernel_ns);
+    fetch.add(fetch_ns);
+}
+
+
+std::string FrameStats::summary(const std::string& kernel_name) const
+{
+    char buff[512];
+    snprintf(buff, sizeof(buff),
+             "ReduceFlicker stats: %s, %llu frames, "
+             "kernel %.3f ms total (p50 <%.1f us, p99 <%.1f us), "
+             "fetch %.3f ms total (p50 <%.1f us, p99 <%.1f us), "
+             "%.1f MiB read, %.1f MiB written",
+             kernel_name.c_str(),
+             static_cast<unsigned long long>(frames.load()),
+             kernel.total.load() / 1e6, kernel.percentile(0.5) / 1e3,
+             kernel.percentile(0.99) / 1e3,
+             fetch.total.load() / 1e6, fetch.percentile(0.5) / 1e3,
+             fetch.percentile(0.99) / 1e3,
+             bytesRead.load() / 1048576.0, bytesWritten.load() / 1048576.0);
+    return buff;
+}
@@ -0,0 +1,65 @@
+/*
+frame_stats.h: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef REDUCE_FLICKER_FRAME_STATS_H
+#define REDUCE_FLICKER_FRAME_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+/*
+ * Cumulative counters of one filter instance, for stats=1.
+ * Frames are rendered on many threads at once, so everything is a relaxed
+ * atomic and no lock is taken. Latencies are counted in power of two buckets
+ * of nanoseconds, so the percentiles are upper bounds within a factor of two.
+ */
+class FrameStats {
+public:
+    static constexpr int NUM_BUCKETS = 64;
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[NUM_BUCKETS];
+        std::atomic<uint64_t> total;
+
+        Histogram();
+        void add(uint64_t ns);
+        uint64_t percentile(double p) const;
+    };
+
+private:
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> bytesWritten;
+    Histogram kernel;
+    Histogram fetch;
+
+public:
+    FrameStats();
+    void add(uint64_t kernel_ns, uint64_t fetch_ns, uint64_t read,
+             uint64_t written);
+    std::string summary(const std::string& kernel_name) const;
+};
+
+#endif
@@ -0,0 +1,216 @@
+/*
+get_proc.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "get_proc.h"
+#include "proc_filter.h"
+
+
+static proc_filter_t get_main_proc_c(int strength, bool aggressive, int bits_per_sample)
+{
+    std::map<proc_key_t, proc_filter_t> table;
+
+    table[make_key(1, false, 8)] = proc_c<uint8_t, int, 1>;
+    table[make_key(1, false, 16)] = proc_c<uint16_t, int, 1>;
+    table[make_key(1, false, 32)] = proc_c<float, float, 1>;
+
+    table[make_key(2, false, 8)] = proc_c<uint8_t, int, 2>;
+    table[make_key(2, false, 16)] = proc_c<uint16_t, int, 2>;
+    table[make_key(2, false, 32)] = proc_c<float, float, 2>;
+
+    table[make_key(3, false, 8)] = proc_c<uint8_t, int, 3>;
+    table[make_key(3, false, 16)] = proc_c<uint16_t, int, 3>;
+    table[make_key(3, false, 32)] = proc_c<float, float, 3>;
+
+    table[make_key(1, true, 8)] = proc_a_c<uint8_t, int, 1>;
+    table[make_key(1, true, 16)] = proc_a_c<uint16_t, int, 1>;
+    table[make_key(1, true, 32)] = proc_a_c<float, float, 1>;
+
+    table[make_key(2, true, 8)] = proc_a_c<uint8_t, int, 2>;
+    table[make_key(2, true, 16)] = proc_a_c<uint16_t, int, 2>;
+    table[make_key(2, true, 32)] = proc_a_c<float, float, 2>;
+
+    table[make_key(3, true, 8)] = proc_a_c<uint8_t, int, 3>;
+    table[make_key(3, true, 16)] = proc_a_c<uint16_t, int, 3>;
+    table[make_key(3, true, 32)] = proc_a_c<float, float, 3>;
+
+    return table[make_key(strength, aggressive, bits_per_sample)];
+}
+
+
+static proc_static_t get_static_proc_c(int strength, int bits_per_sample)
+{
+    std::map<proc_key_t, proc_static_t> table;
+
+    table[make_key(1, false, 8)] = proc_s<uint8_t, uint8_t, 1>;
+    table[make_key(1, false, 16)] = proc_s<uint16_t, uint16_t, 1>;
+    table[make_key(1, false, 32)] = proc_s<float, float, 1>;
+
+    table[make_key(2, false, 8)] = proc_s<uint8_t, uint8_t, 2>;
+    table[make_key(2, false, 16)] = proc_s<uint16_t, uint16_t, 2>;
+    table[make_key(2, false, 32)] = proc_s<float, float, 2>;
+
+    table[make_key(3, false, 8)] = proc_s<uint8_t, uint8_t, 3>;
+    table[make_key(3, false, 16)] = proc_s<uint16_t, uint16_t, 3>;
+    table[make_key(3, false, 32)] = proc_s<float, float, 3>;
+
+    return table[make_key(strength, false, bits_per_sample)];
+}
+
+
+/*
+ * If the unit for arch was built without its instruction set, fall back to
+ * the next narrower one. bits_per_sample 10 only exists for SSE2.
+ * The C kernels have no store, prefetch or access variants; they touch
+ * exactly width samples of a row wherever it starts.
+ */
+proc_filter_t
+get_main_proc(arch_t arch, int strength, bool aggressive, int bits_per_sample,
+              store_t store, int prefetch, access_t access)
+{
+    proc_filter_t proc = nullptr;
+#if defined(INTEL_X86_CPU)
+    switch (arch) {
+    case USE_AVX512:
+        proc = get_main_proc_avx512(strength, aggressive, bits_per_sample, store,
+                                    prefetch, access);
+        if (proc) {
+            break;
+        }
+        // fall through
+    case USE_AVX2:
+        proc = get_main_proc_avx2(strength, aggressive, bits_per_sample, store,
+                                  prefetch, access);
+        if (proc) {
+            break;
+        }
+        // fall through
+    case USE_SSE41:
+        proc = get_main_proc_sse41(strength, aggressive, bits_per_sample, store,
+                                   prefetch, access);
+        if (proc) {
+            break;
+        }
+        // fall through
+    case USE_SSE2:
+        proc = get_main_proc_sse2(strength, aggressive, bits_per_sample, store,
+                                  prefetch, access);
+        break;
+    default:
+        break;
+    }
+#endif
+    if (!proc) {
+        proc = get_main_proc_c(strength, aggressive,
+                               bits_per_sample == 10 ? 16 : bits_per_sample);
+    }
+    return proc;
+}
+
+
+proc_static_t get_static_proc(arch_t arch, int strength, int bits_per_sample)
+{
+    proc_static_t proc = nullptr;
+#if defined(INTEL_X86_CPU)
+    switch (arch) {
+    case USE_AVX512:
+        proc = get_static_proc_avx512(strength, bits_per_sample);
+        if (proc) {
+            break;
+        }
+        // fall through
+    case USE_AVX2:
+        proc = get_static_proc_avx2(strength, bits_per_sample);
+        if (proc) {
+            break;
+        }
+        // fall through
+    case USE_SSE41:
+        proc = get_static_proc_sse41(strength, bits_per_sample);
+        if (proc) {
+            break;
+        }
+        // fall through
+    case USE_SSE2:
+        proc = get_static_proc_sse2(strength, bits_per_sample);
+        break;
+    default:
+        break;
+    }
+#endif
+    if (!proc) {
+        proc = get_static_proc_c(strength,
+                                 bits_per_sample == 10 ? 16 : bits_per_sample);
+    }
+    return proc;
+}
+
+
+arch_t get_proc_arch(arch_t arch, int bits_per_sample)
+{
+#if defined(INTEL_X86_CPU)
+    switch (arch) {
+    case USE_AVX512:
+        if (get_main_proc_avx512(1, false, bits_per_sample, STORE_STREAM, 0,
+                                 ACCESS_ALIGNED)) {
+            return USE_AVX512;
+        }
+        // fall through
+    case USE_AVX2:
+        if (get_main_proc_avx2(1, false, bits_per_sample, STORE_STREAM, 0,
+                               ACCESS_ALIGNED)) {
+            return USE_AVX2;
+        }
+        // fall through
+    case USE_SSE41:
+        if (get_main_proc_sse41(1, false, bits_per_sample, STORE_STREAM, 0,
+                                ACCESS_ALIGNED)) {
+            return USE_SSE41;
+        }
+        // fall through
+    case USE_SSE2:
+        if (get_main_proc_sse2(1, false, bits_per_sample, STORE_STREAM, 0,
+                               ACCESS_ALIGNED)) {
+            return USE_SSE2;
+        }
+        break;
+    default:
+        break;
+    }
+#endif
+    return NO_SIMD;
+}
+
+
+size_t get_proc_align(arch_t arch)
+{
+    switch (arch) {
+    case USE_SSE2:
+    case USE_SSE41:
+        return 16;
+    case USE_AVX2:
+        return 32;
+    default:
+        // the AVX-512 kernels load unaligned and mask the end of each row.
+        return 1;
+    }
+}
@@ -0,0 +1,150 @@
+/*
+get_proc.h: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef REDUCE_FLICKER_GET_PROC_H
+#define REDUCE_FLICKER_GET_PROC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include "arch.h"
+
+
+/*
+ * How the SIMD kernels write dst. Non-temporal stores keep a large output
+ * from evicting the source frames. Regular stores leave a small one in cache
+ * for the next filter.
+ */
+enum store_t {
+    STORE_STREAM,
+    STORE_TEMPORAL,
+};
+
+
+/*
+ * How the SIMD kernels address a row. The aligned kernels need every row to
+ * start on a vector boundary, and read and write whole vectors into the
+ * stride padding. The unaligned ones accept any pointer and touch exactly
+ * width samples of each row, for frames which are views into other buffers.
+ */
+enum access_t {
+    ACCESS_ALIGNED,
+    ACCESS_UNALIGNED,
+};
+
+
+/*
+ * Distances in bytes at which the main SIMD kernels can prefetch their
+ * inputs ahead of use. Strength 2 and 3 read 5 and 7 frames, more streams
+ * than some hardware prefetchers follow well. Strength 1 and the C kernels
+ * ignore the distance.
+ */
+constexpr int prefetch_distances[] = {0, 256, 512, 1024, 2048};
+
+
+typedef void (*proc_filter_t)(
+    uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
+    const uint8_t** nextp, int dstride, int cstride, int* pstride, int* nstride,
+    size_t width, size_t height);
+
+
+/*
+ * A main kernel wrapped so that tiles where curr and every neighbor are
+ * identical are copied instead of processed. Returns the number of such tiles.
+ */
+typedef size_t (*proc_static_t)(
+    proc_filter_t proc, uint8_t* dstp, const uint8_t* currp,
+    const uint8_t** prevp, const uint8_t** nextp, int dstride, int cstride,
+    int* pstride, int* nstride, size_t width, size_t height);
+
+
+namespace {
+/*
+ * Key of the dispatch tables. It is local to each translation unit, so that
+ * the std::map code instantiated in a proc_filter_*.cpp (built with that
+ * unit's instruction set) can never be merged into another unit by the linker.
+ */
+struct proc_key_t {
+    int strength;
+    bool aggressive;
+    int bits;
+
+    bool operator<(const proc_key_t& k) const
+    {
+        if (strength != k.strength) {
+            return strength < k.strength;
+        }
+        if (aggressive != k.aggressive) {
+            return aggressive < k.aggressive;
+        }
+        return bits < k.bits;
+    }
+};
+
+inline proc_key_t make_key(int strength, bool aggressive, int bits)
+{
+    return {strength, aggressive, bits};
+}
+}
+
+
+proc_filter_t
+get_main_proc(arch_t arch, int strength, bool aggressive, int bits_per_sample,
+              store_t store, int prefetch, access_t access);
+
+proc_static_t
+get_static_proc(arch_t arch, int strength, int bits_per_sample);
+
+// the instruction set whose unit the functions above end up using.
+arch_t get_proc_arch(arch_t arch, int bits_per_sample);
+
+// the alignment of pointers and strides the ACCESS_ALIGNED kernels of arch need.
+size_t get_proc_align(arch_t arch);
+
+
+/*
+ * Each of these is defined in its own translation unit which is compiled
+ * with the matching instruction set enabled. They return nullptr if that
+ * unit was built without it.
+ */
+#if defined(INTEL_X86_CPU)
+proc_filter_t
+get_main_proc_sse2(int strength, bool aggressive, int bits_per_sample,
+                   store_t store, int prefetch, access_t access);
+proc_filter_t
+get_main_proc_sse41(int strength, bool aggressive, int bits_per_sample,
+                    store_t store, int prefetch, access_t access);
+proc_filter_t
+get_main_proc_avx2(int strength, bool aggressive, int bits_per_sample,
+                   store_t store, int prefetch, access_t access);
+proc_filter_t
+get_main_proc_avx512(int strength, bool aggressive, int bits_per_sample,
+                     store_t store, int prefetch, access_t access);
+
+proc_static_t get_static_proc_sse2(int strength, int bits_per_sample);
+proc_static_t get_static_proc_sse41(int strength, int bits_per_sample);
+proc_static_t get_static_proc_avx2(int strength, int bits_per_sample);
+proc_static_t get_static_proc_avx512(int strength, int bits_per_sample);
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/*
+lookahead_cache.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+
+#include "lookahead_cache.h"
+
+
+LookaheadCache::LookaheadCache(int sz, int num_frames, size_t cap,
+                               const VSAPI* vsapi) :
+    size(sz), numFrames(num_frames), capacity(cap), serial(0), api(vsapi)
+{
+}
+
+
+LookaheadCache::~LookaheadCache()
+{
+    for (auto& b : blocks) {
+        freeBlock(*b.second);
+    }
+}
+
+
+void LookaheadCache::freeBlock(Block& b)
+{
+    for (auto& f : b.frames) {
+        if (f) {
+            api->freeFrame(f);
+            f = nullptr;
+        }
+    }
+}
+
+
+// called with mtx held. blocks being rendered are never dropped.
+void LookaheadCache::evict()
+{
+    while (blocks.size() > capacity) {
+        auto oldest = blocks.end();
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            if (!it->second->done) {
+                continue;
+            }
+            if (oldest == blocks.end()
+                    || it->second->serial < oldest->second->serial) {
+                oldest = it;
+            }
+        }
+        if (oldest == blocks.end()) {
+            return;
+        }
+        freeBlock(*oldest->second);
+        blocks.erase(oldest);
+    }
+}
+
+
+/*
+ * Returns frame n if its block has been rendered and the frame has not been
+ * handed out yet, or nullptr. It does not wait.
+ */
+const VSFrame* LookaheadCache::take(int n)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+
+    auto it = blocks.find(getBlockStart(n));
+    if (it == blocks.end() || !it->second->done) {
+        return nullptr;
+    }
+    Block& b = *it->second;
+    const VSFrame* f = b.frames[n - it->first];
+    b.frames[n - it->first] = nullptr;
+    if (std::all_of(b.frames.begin(), b.frames.end(),
+                    [](const VSFrame* x) { return x == nullptr; })) {
+        blocks.erase(it);
+    }
+    return f;
+}
+
+
+/*
+ * Returns frame n, rendering its block first if nobody has. If the frame
+ * was handed out before (the core may request a frame again after dropping
+ * it), only frame n is rendered again.
+ * The frames of the whole block must have been requested by the caller.
+ */
+const VSFrame* LookaheadCache::get(int n, const render_t& render)
+{
+    const int start = getBlockStart(n);
+    std::shared_ptr<Block> b;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& entry = blocks[start];
+        if (!entry) {
+            entry = std::make_shared<Block>();
+            entry->frames.assign(getBlockCount(start), nullptr);
+            entry->done = false;
+        }
+        entry->serial = serial++;
+        b = entry;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(b->mtx);
+        if (!b->done) {
+            std::vector<const VSFrame*> frames(b->frames.size());
+            render(start, static_cast<int>(frames.size()), frames.data());
+            std::lock_guard<std::mutex> cache_lock(mtx);
+            b->frames = frames;
+            b->done = true;
+            evict();
+        }
+    }
+
+    const VSFrame* f = take(n);
+    if (!f) {
+        render(n, 1, &f);
+    }
+    return f;
+}
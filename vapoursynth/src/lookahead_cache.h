@@ -0,0 +1,83 @@
+/*
+lookahead_cache.h: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+
+#ifndef REDUCE_FLICKER_LOOKAHEAD_CACHE_H
+#define REDUCE_FLICKER_LOOKAHEAD_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <VapourSynth4.h>
+
+
+/*
+ * Output frames rendered ahead of their request. Frames are grouped in
+ * blocks of size frames starting at multiples of size. The first request of
+ * a frame of a block renders the whole block; requests for the other frames
+ * of the block which arrive meanwhile wait for it. A frame is handed out
+ * once. Idle blocks beyond capacity are dropped, oldest first.
+ */
+class LookaheadCache {
+public:
+    // renders count frames from start into out.
+    typedef std::function<void(int start, int count, const VSFrame** out)>
+        render_t;
+
+private:
+    struct Block {
+        std::mutex mtx;
+        std::vector<const VSFrame*> frames;
+        uint64_t serial;
+        bool done;
+    };
+
+    std::map<int, std::shared_ptr<Block>> blocks;
+    std::mutex mtx;
+    int size;
+    int numFrames;
+    size_t capacity;
+    uint64_t serial;
+    const VSAPI* api;
+
+    void freeBlock(Block& b);
+    void evict();
+
+public:
+    LookaheadCache(int size, int num_frames, size_t capacity,
+                   const VSAPI* api);
+    ~LookaheadCache();
+    int getBlockStart(int n) const { return n - n % size; }
+    int getBlockCount(int start) const
+    {
+        return std::min(size, numFrames - start);
+    }
+    const VSFrame* take(int n);
+    const VSFrame* get(int n, const render_t& render);
+};
+
+#endif
@@ -26,8 +26,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <string>
-#include <VapourSynth.h>
+#include <VapourSynth4.h>
 #include "arch.h"
 
 
@@ -40,12 +41,24 @@ static F_INLINE void validate(bool cond, const char* msg)
 
 static F_INLINE bool is_constant_format(const VSVideoInfo& vi)
 {
-    return vi.height > 0 && vi.width > 0 && vi.format;
+    return vi.height > 0 && vi.width > 0 && vi.format.colorFamily != cfUndefined;
+}
+
+static F_INLINE bool
+is_same_video_info(const VSVideoInfo& a, const VSVideoInfo& b)
+{
+    return a.width == b.width && a.height == b.height
+        && a.numFrames == b.numFrames
+        && a.format.colorFamily == b.format.colorFamily
+        && a.format.sampleType == b.format.sampleType
+        && a.format.bitsPerSample == b.format.bitsPerSample
+        && a.format.subSamplingW == b.format.subSamplingW
+        && a.format.subSamplingH == b.format.subSamplingH;
 }
 
 static F_INLINE bool is_half_precision(const VSVideoInfo& vi)
 {
-    return vi.format->sampleType == stFloat && vi.format->bitsPerSample == 16;
+    return vi.format.sampleType == stFloat && vi.format.bitsPerSample == 16;
 }
 
 
@@ -57,7 +70,7 @@ F_INLINE int32_t
 get_prop<int32_t>(const VSAPI* api, const VSMap* in, const char* name, int idx,
                   int* e)
 {
-    return static_cast<int32_t>(api->propGetInt(in, name, idx, e));
+    return static_cast<int32_t>(api->mapGetInt(in, name, idx, e));
 }
 
 template <>
@@ -65,7 +78,7 @@ F_INLINE int64_t
 get_prop<int64_t>(const VSAPI* api, const VSMap* in, const char* name, int idx,
                   int* e)
 {
-    return api->propGetInt(in, name, idx, e);
+    return api->mapGetInt(in, name, idx, e);
 }
 
 template <>
@@ -73,7 +86,7 @@ F_INLINE bool
 get_prop<bool>(const VSAPI* api, const VSMap* in, const char* name, int idx,
                int* e)
 {
-    return api->propGetInt(in, name, idx, e) != 0;
+    return api->mapGetInt(in, name, idx, e) != 0;
 }
 
 template <>
@@ -81,7 +94,7 @@ F_INLINE float
 get_prop<float>(const VSAPI* api, const VSMap* in, const char* name, int idx,
                 int* e)
 {
-    return static_cast<float>(api->propGetFloat(in, name, idx, e));
+    return static_cast<float>(api->mapGetFloat(in, name, idx, e));
 }
 
 template <>
@@ -89,7 +102,7 @@ F_INLINE double
 get_prop<double>(const VSAPI* api, const VSMap* in, const char* name, int idx,
                  int* e)
 {
-    return api->propGetFloat(in, name, idx, e);
+    return api->mapGetFloat(in, name, idx, e);
 }
 
 template <>
@@ -97,7 +110,7 @@ F_INLINE const char*
 get_prop<const char*>(const VSAPI* api, const VSMap* in, const char* name,
                       int idx, int* e)
 {
-    return api->propGetData(in, name, idx, e);
+    return api->mapGetData(in, name, idx, e);
 }
 
 template <typename T>
@@ -114,15 +127,23 @@ get_arg(const char* name, const T default_value, int index, const VSMap* in,
 }
 
 static F_INLINE int
-get_sized_stride(const VSFrameRef* f, const int plane, const VSVideoInfo& vi,
+get_sized_stride(const VSFrame* f, const int plane, const VSVideoInfo& vi,
                  const VSAPI* api)
 {
-    return api->getStride(f, plane) / vi.format->bytesPerSample;
+    return static_cast<int>(api->getStride(f, plane)) / vi.format.bytesPerSample;
+}
+
+
+static F_INLINE int get_num_threads(VSCore* core, const VSAPI* api)
+{
+    VSCoreInfo info;
+    api->getCoreInfo(core, &info);
+    return info.numThreads;
 }
 
 
 static F_INLINE size_t
-get_row_size(const VSFrameRef* f, const int plane, const VSFormat* fmt,
+get_row_size(const VSFrame* f, const int plane, const VSVideoFormat* fmt,
              const VSAPI* api)
 {
     return api->getFrameWidth(f, plane) * fmt->bytesPerSample;
@@ -22,32 +22,58 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 
 #include <algorithm>
+#include <iterator>
+#include <vector>
 #include "myvshelper.h"
 #include "ReduceFlicker.h"
+#include "trace.h"
 
-static const VSFrameRef* VS_CC
-get_frame(int n, int activation_reason, void** instance_data, void**,
+static const VSFrame* VS_CC
+get_frame(int n, int activation_reason, void* instance_data, void** frame_data,
           VSFrameContext* frame_ctx, VSCore* core, const VSAPI* api)
 {
-    auto d = reinterpret_cast<ReduceFlicker*>(*instance_data);
+    auto d = reinterpret_cast<ReduceFlicker*>(instance_data);
 
     if (activation_reason == arInitial) {
-        d->requestFrames(n, d->vi.numFrames - 1, d->clip, api, frame_ctx);
+        TRACE_SCOPE("requestFrames", n);
+        if (d->lookahead) {
+            // rendered with an earlier frame of its block.
+            const VSFrame* f = d->lookahead->take(n);
+            if (f) {
+                return f;
+            }
+        }
+        if (d->sceneChange) {
+            d->requestSceneFrames(n, frame_data, api, frame_ctx);
+        } else {
+            d->requestWindow(n, frame_data, api, frame_ctx);
+        }
+        TRACE_ASYNC_BEGIN("waitFrames", d, n);
         return nullptr;
     }
     if (activation_reason != arAllFramesReady) {
+        TRACE_ASYNC_END("waitFrames", d, n);
+        if (activation_reason == arError) {
+            if (!d->sceneChange) {
+                d->windowReady(*frame_data, true);
+            }
+            d->freeFrameData(frame_data);
+        }
         return nullptr;
     }
-    return d->getFrame(n, core, api, frame_ctx);
-}
-
-
-static void VS_CC
-init_filter(VSMap* in, VSMap* out, void** instance_data, VSNode* node,
-            VSCore* core, const VSAPI* api)
-{
-    auto d = reinterpret_cast<ReduceFlicker*>(*instance_data);
-    api->setVideoInfo(&d->vi, 1, node);
+    // the window is found over several stages, each one requesting the
+    // frames next to the ones already known to be in the scene.
+    if (d->sceneChange) {
+        if (!d->requestSceneFrames(n, frame_data, api, frame_ctx)) {
+            return nullptr;
+        }
+    } else {
+        d->windowReady(*frame_data, false);
+    }
+    TRACE_ASYNC_END("waitFrames", d, n);
+    const VSFrame* dst = d->getFrame(n, *frame_data, core, api, frame_ctx);
+    d->freeFrameData(frame_data);
+    return dst;
 }
 
 
@@ -55,7 +81,13 @@ static void VS_CC
 free_filter(void* instance_data, VSCore* core, const VSAPI* api)
 {
     auto d = reinterpret_cast<ReduceFlicker*>(instance_data);
+    d->logStats(core, api);
+    TRACE_FLUSH();
     api->freeNode(d->clip);
+    for (int i = 0; i < 3; ++i) {
+        api->freeNode(d->prevClips[i]);
+        api->freeNode(d->nextClips[i]);
+    }
     delete d;
 }
 
@@ -63,7 +95,7 @@ free_filter(void* instance_data, VSCore* core, const VSAPI* api)
 static void
 set_planes(int* planes, const VSMap* in, const VSAPI* api)
 {
-    int num = api->propNumElements(in, "planes");
+    int num = api->mapNumElements(in, "planes");
     validate(num > 3, "length of 'planes' must be equal or smaller than 3.");
 
     if (num == 0) {
@@ -83,7 +115,19 @@ set_planes(int* planes, const VSMap* in, const VSAPI* api)
 static void VS_CC
 create_filter(const VSMap* in, VSMap* out, void*, VSCore* core, const VSAPI* api)
 {
-    VSNodeRef* clip = api->propGetNode(in, "clip", 0, nullptr);
+    VSNode* clip = api->mapGetNode(in, "clip", 0, nullptr);
+
+    // -1 if not set.
+    const int num_prev = api->mapNumElements(in, "prev");
+    const int num_next = api->mapNumElements(in, "next");
+    VSNode* prev[3] = {};
+    VSNode* next[3] = {};
+    for (int i = 0; i < std::min(num_prev, 3); ++i) {
+        prev[i] = api->mapGetNode(in, "prev", i, nullptr);
+    }
+    for (int i = 0; i < std::min(num_next, 3); ++i) {
+        next[i] = api->mapGetNode(in, "next", i, nullptr);
+    }
 
     try {
         int str = get_arg("strength", 2, 0, in, api);
@@ -94,30 +138,106 @@ create_filter(const VSMap* in, VSMap* out, void*, VSCore* core, const VSAPI* api
         int planes[] = {1, 1, 1};
         set_planes(planes, in, api);
 
-        arch_t arch = get_arch(get_arg("opt", 3, 0, in, api));
-
-        auto d = new ReduceFlicker(clip, str, agr, planes, arch, core, api);
-
-        api->createFilter(in, out, "ReduceFlicker", init_filter, get_frame,
-                          free_filter, fmParallel, 0, d, core);
+        int opt = get_arg("opt", 4, 0, in, api);
+        bool autotune = opt == -1;
+        arch_t arch = get_arch(autotune ? 4 : opt);
+
+        int store = get_arg("store", 0, 0, in, api);
+        validate(store < 0 || store > 2, "store must be set to 0, 1 or 2.");
+
+        int prefetch = get_arg("prefetch", 0, 0, in, api);
+        validate(std::find(std::begin(prefetch_distances),
+                           std::end(prefetch_distances), prefetch)
+                     == std::end(prefetch_distances),
+                 "prefetch must be set to 0, 256, 512, 1024 or 2048.");
+
+        bool bands = get_arg("bands", false, 0, in, api);
+
+        int lookahead = get_arg("lookahead", 1, 0, in, api);
+        validate(lookahead < 1 || lookahead > 16,
+                 "lookahead must be between 1 and 16.");
+
+        bool skipstatic = get_arg("skipstatic", false, 0, in, api);
+
+        bool scenechange = get_arg("scenechange", false, 0, in, api);
+        validate(scenechange && lookahead > 1,
+                 "scenechange and lookahead cannot be used together.");
+
+        bool stats = get_arg("stats", false, 0, in, api);
+
+        int threads = get_arg("threads", 1, 0, in, api);
+        validate(threads < 0, "threads must be set to 0 or greater.");
+
+        int order = get_arg("order", 0, 0, in, api);
+        validate(order < 0 || order > 2, "order must be set to 0, 1 or 2.");
+
+        const bool neighbors = num_prev > 0 || num_next > 0;
+        if (neighbors) {
+            validate(num_prev != (str > 2 ? 3 : 2),
+                     "prev must have 2 clips, or 3 clips with strength=3.");
+            validate(num_next != str,
+                     "next must have as many clips as strength.");
+            validate(scenechange,
+                     "prev/next and scenechange cannot be used together.");
+            validate(lookahead > 1,
+                     "prev/next and lookahead cannot be used together.");
+        }
+
+        auto d = new ReduceFlicker(clip, str, agr, planes, arch, autotune,
+                                   store, prefetch, bands, lookahead,
+                                   skipstatic, scenechange, stats, threads,
+                                   order, prev, next, core, api);
+
+        // every source frame is used by several output frames, unless the
+        // neighbors come from prev/next. then each clip gives only frame n.
+        std::vector<VSFilterDependency> deps = {
+            {clip, neighbors ? rpStrictSpatial : rpGeneral}
+        };
+        for (int i = 0; i < 3; ++i) {
+            for (VSNode* node : {prev[i], next[i]}) {
+                if (node) {
+                    deps.push_back({node, rpStrictSpatial});
+                }
+            }
+        }
+
+        api->createVideoFilter(out, "ReduceFlicker", &d->vi, get_frame,
+                               free_filter, fmParallel, deps.data(),
+                               static_cast<int>(deps.size()), d, core);
 
     } catch (std::string e) {
         api->freeNode(clip);
-        api->setError(out, ("ReduceFlicker: " + e).c_str());
+        for (int i = 0; i < 3; ++i) {
+            api->freeNode(prev[i]);
+            api->freeNode(next[i]);
+        }
+        api->mapSetError(out, ("ReduceFlicker: " + e).c_str());
     }
 }
 
 VS_EXTERNAL_API(void)
-VapourSynthPluginInit(VSConfigPlugin conf, VSRegisterFunction reg, VSPlugin* p)
+VapourSynthPluginInit2(VSPlugin* p, const VSPLUGINAPI* vspapi)
 {
-    conf("chikuzen.does.not.have.his.own.domain.reduceflicker", "rdfl",
-         "ReduceFlicker for VapourSynth ver. 0.0.0",
-         VAPOURSYNTH_API_VERSION, 1, p);
-    reg("ReduceFlicker",
-        "clip:clip;"
+    vspapi->configPlugin("chikuzen.does.not.have.his.own.domain.reduceflicker",
+                         "rdfl", "ReduceFlicker for VapourSynth ver. 0.0.0",
+                         VS_MAKE_VERSION(0, 0), VAPOURSYNTH_API_VERSION, 0, p);
+    vspapi->registerFunction("ReduceFlicker",
+        "clip:vnode;"
         "strength:int:opt;"
         "aggressive:int:opt;"
         "planes:int[]:opt;"
-        "opt:int:opt",
+        "opt:int:opt;"
+        "store:int:opt;"
+        "prefetch:int:opt;"
+        "bands:int:opt;"
+        "lookahead:int:opt;"
+        "skipstatic:int:opt;"
+        "scenechange:int:opt;"
+        "stats:int:opt;"
+        "threads:int:opt;"
+        "order:int:opt;"
+        "prev:vnode[]:opt;"
+        "next:vnode[]:opt;",
+        "clip:vnode;",
         create_filter, nullptr, p);
 }
\ No newline at end of file
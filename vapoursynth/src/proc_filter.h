@@ -26,7 +26,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include <stdint.h>
 #include <algorithm>
+#include <cstring>
 #include "arch.h"
+#include "get_proc.h"
 
 
 template <typename T>
@@ -67,7 +69,7 @@ proc_c(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
     const T0* cur0 = reinterpret_cast<const T0*>(currp);
     prv0 = reinterpret_cast<const T0*>(prevp[0]);
     prv1 = reinterpret_cast<const T0*>(prevp[1]);
-    nxt0 = reinterpret_cast<const T0*>(prevp[0]);
+    nxt0 = reinterpret_cast<const T0*>(nextp[0]);
     dstride /= sizeof(T0);
     cstride /= sizeof(T0);
     pstride[0] /= sizeof(T0);
@@ -79,7 +81,7 @@ proc_c(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
     }
     if (STRENGTH > 2) {
         prv2 = reinterpret_cast<const T0*>(prevp[2]);
-        nxt2 = reinterpret_cast<const T0*>(prevp[2]);
+        nxt2 = reinterpret_cast<const T0*>(nextp[2]);
         pstride[2] /= sizeof(T0);
         nstride[2] /= sizeof(T0);
     }
@@ -144,7 +146,7 @@ proc_a_c(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
     const T0* cur0 = reinterpret_cast<const T0*>(currp);
     prv0 = reinterpret_cast<const T0*>(prevp[0]);
     prv1 = reinterpret_cast<const T0*>(prevp[1]);
-    nxt0 = reinterpret_cast<const T0*>(prevp[0]);
+    nxt0 = reinterpret_cast<const T0*>(nextp[0]);
     dstride /= sizeof(T0);
     cstride /= sizeof(T0);
     pstride[0] /= sizeof(T0);
@@ -156,7 +158,7 @@ proc_a_c(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
     }
     if (STRENGTH > 2) {
         prv2 = reinterpret_cast<const T0*>(prevp[2]);
-        nxt2 = reinterpret_cast<const T0*>(prevp[2]);
+        nxt2 = reinterpret_cast<const T0*>(nextp[2]);
         pstride[2] /= sizeof(T0);
         nstride[2] /= sizeof(T0);
     }
@@ -200,12 +202,154 @@ proc_a_c(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
 }
 
 
+/*
+ * proc_s: calls proc only for the parts of each row which are not static.
+ * A tile is STATIC_TILE_SIZE bytes of a row. If curr and all the frames the
+ * kernel reads are identical in a tile, the kernel would output curr there,
+ * so the tile is copied instead.
+ * V is the vector type used to compare tiles. The generic version (used with
+ * the sample type) compares them with memcmp.
+ */
+constexpr size_t STATIC_TILE_SIZE = 64;
+
+template <typename V>
+static F_INLINE bool
+is_static_tile(const uint8_t* currp, const uint8_t* const* srcp, int num,
+               size_t x, size_t bytes)
+{
+    for (int i = 0; i < num; ++i) {
+        if (memcmp(currp + x, srcp[i] + x, bytes) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+template <typename T, typename V, int STRENGTH>
+static size_t
+proc_s(proc_filter_t proc, uint8_t* dstp, const uint8_t* currp,
+       const uint8_t** prevp, const uint8_t** nextp, int dstride, int cstride,
+       int* pstride, int* nstride, size_t width, size_t height) noexcept
+{
+    // prevp[0], prevp[1], nextp[0], nextp[1], prevp[2], nextp[2]
+    constexpr int num = STRENGTH == 1 ? 3 : STRENGTH == 2 ? 4 : 6;
+    const uint8_t* srcp[6] = {prevp[0], prevp[1], nextp[0]};
+    int sstride[6] = {pstride[0], pstride[1], nstride[0]};
+    if (STRENGTH > 1) {
+        srcp[3] = nextp[1];
+        sstride[3] = nstride[1];
+    }
+    if (STRENGTH > 2) {
+        srcp[4] = prevp[2];
+        srcp[5] = nextp[2];
+        sstride[4] = pstride[2];
+        sstride[5] = nstride[2];
+    }
+
+    auto run = [&](size_t start, size_t end, bool still) {
+        if (still) {
+            memcpy(dstp + start, currp + start, end - start);
+            return;
+        }
+        const uint8_t* prv[3] = {srcp[0] + start, srcp[1] + start};
+        const uint8_t* nxt[3] = {srcp[2] + start};
+        int ps[3] = {sstride[0], sstride[1]};
+        int ns[3] = {sstride[2]};
+        if (STRENGTH > 1) {
+            nxt[1] = srcp[3] + start;
+            ns[1] = sstride[3];
+        }
+        if (STRENGTH > 2) {
+            prv[2] = srcp[4] + start;
+            nxt[2] = srcp[5] + start;
+            ps[2] = sstride[4];
+            ns[2] = sstride[5];
+        }
+        proc(dstp + start, currp + start, prv, nxt, dstride, cstride, ps, ns,
+             (end - start) / sizeof(T), 1);
+    };
+
+    const size_t rowsize = width * sizeof(T);
+    size_t skipped = 0;
+
+    for (size_t y = 0; y < height; ++y) {
+        // consecutive tiles of the same kind are handled with one call.
+        size_t start = 0;
+        bool still = false;
+        for (size_t x = 0; x < rowsize; x += STATIC_TILE_SIZE) {
+            const size_t bytes = rowsize - x < STATIC_TILE_SIZE
+                               ? rowsize - x : STATIC_TILE_SIZE;
+            const bool s = is_static_tile<V>(currp, srcp, num, x, bytes);
+            if (s != still && x > start) {
+                run(start, x, still);
+                start = x;
+            }
+            still = s;
+            skipped += s;
+        }
+        run(start, rowsize, still);
+        dstp += dstride;
+        currp += cstride;
+        for (int i = 0; i < num; ++i) {
+            srcp[i] += sstride[i];
+        }
+    }
+    return skipped;
+}
+
+
 /****************************** SIMD version *********************/
 
 #include "simd.h"
 #if defined(__SSE2__)
 
-template <typename T, typename V, int STRENGTH, arch_t ARCH>
+template <access_t ACCESS, typename V>
+static F_INLINE V read_part(const uint8_t* p, size_t rem)
+{
+    return ACCESS == ACCESS_ALIGNED ? load_part<V>(p, rem)
+                                    : loadu_part<V>(p, rem);
+}
+
+
+template <store_t STORE, access_t ACCESS, typename V>
+static F_INLINE void write_part(uint8_t* p, const V& x, size_t rem)
+{
+    if (ACCESS == ACCESS_UNALIGNED) {
+        // a view may still happen to be aligned.
+        if (STORE == STORE_STREAM && rem >= sizeof(V)
+                && (reinterpret_cast<uintptr_t>(p) & (sizeof(V) - 1)) == 0) {
+            stream(p, x);
+        } else {
+            storeu_part(p, x, rem);
+        }
+    } else if (STORE == STORE_STREAM) {
+        stream_part(p, x, rem);
+    } else {
+        store_part(p, x, rem);
+    }
+}
+
+
+/*
+ * Prefetches the byte DIST after x of a row. Past the end of the row it
+ * continues on the next row of the same frame, whose stride may differ from
+ * the other frames'. Prefetching past the last row does no harm.
+ * proc_simd/proc_a_simd with PF > 0 call it once per cache line of each
+ * input.
+ */
+template <int DIST>
+static F_INLINE void
+prefetch_ahead(const uint8_t* row, int stride, size_t x, size_t width)
+{
+    const size_t t = x + DIST;
+    const uint8_t* p = t < width ? row + t : row + stride + (t - width);
+    _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0);
+}
+
+
+template <typename T, typename V, int STRENGTH, arch_t ARCH, access_t ACCESS,
+          store_t STORE, int PF>
 static void
 proc_simd(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
           const uint8_t** nextp, int dstride, int cstride, int* pstride,
@@ -229,21 +373,35 @@ proc_simd(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
 
     for (size_t y = 0; y < height; ++y) {
         for (size_t x = 0; x < width; x += sizeof(V)) {
-            const V curx = load<V>(currp + x);
-            V d = abs_diff<T, V>(curx, load<V>(prv1 + x));
+            const size_t rem = width - x;
+            if (PF > 0 && x % 64 == 0) {
+                prefetch_ahead<PF>(currp, cstride, x, width);
+                prefetch_ahead<PF>(prv0, pstride[0], x, width);
+                prefetch_ahead<PF>(prv1, pstride[1], x, width);
+                prefetch_ahead<PF>(nxt0, nstride[0], x, width);
+                if (STRENGTH > 1) {
+                    prefetch_ahead<PF>(nxt1, nstride[1], x, width);
+                }
+                if (STRENGTH > 2) {
+                    prefetch_ahead<PF>(prv2, pstride[2], x, width);
+                    prefetch_ahead<PF>(nxt2, nstride[2], x, width);
+                }
+            }
+            const V curx = read_part<ACCESS, V>(currp + x, rem);
+            V d = abs_diff<T, V>(curx, read_part<ACCESS, V>(prv1 + x, rem));
             if (STRENGTH > 1) {
-                d = min<T, ARCH>(d, abs_diff<T, V>(curx, load<V>(nxt1 + x)));
+                d = min<T, ARCH>(d, abs_diff<T, V>(curx, read_part<ACCESS, V>(nxt1 + x, rem)));
             }
             if (STRENGTH > 2) {
-                d = min<T, ARCH>(d, abs_diff<T, V>(curx, load<V>(prv2 + x)));
-                d = min<T, ARCH>(d, abs_diff<T, V>(curx, load<V>(nxt2 + x)));
+                d = min<T, ARCH>(d, abs_diff<T, V>(curx, read_part<ACCESS, V>(prv2 + x, rem)));
+                d = min<T, ARCH>(d, abs_diff<T, V>(curx, read_part<ACCESS, V>(nxt2 + x, rem)));
             }
-            const V pr0 = load<V>(prv0 + x);
-            const V nx0 = load<V>(nxt0 + x);
+            const V pr0 = read_part<ACCESS, V>(prv0 + x, rem);
+            const V nx0 = read_part<ACCESS, V>(nxt0 + x, rem);
             const V ul = max<T, ARCH>(sub<T>(min<T, ARCH>(pr0, nx0), d), curx);
             const V ll = min<T, ARCH>(add<T>(max<T, ARCH>(pr0, nx0), d), curx);
             const V avg = get_avg<T, V>(pr0, nx0, curx, q);
-            stream(dstp + x, clamp<T, V, ARCH>(avg, ll, ul));
+            write_part<STORE, ACCESS>(dstp + x, clamp<T, V, ARCH>(avg, ll, ul), rem);
         }
         prv0 += pstride[0];
         prv1 += pstride[1];
@@ -261,6 +419,21 @@ proc_simd(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
 }
 
 
+/*
+ * d1 = x >= y ? x - y : 0
+ * d2 = x >= y ? 0 : y - x
+ */
+template <typename T, typename V, arch_t ARCH>
+static F_INLINE void init_diff(const V& x, const V& y, V& d1, V& d2)
+{
+    const V maxxy = max<T, ARCH>(x, y);
+    const V mask = cmpeq<T>(x, maxxy);
+    const V d = sub<T>(maxxy, min<T, ARCH>(x, y));
+    d1 = and_reg(mask, d);
+    d2 = andnot_reg(mask, d);
+}
+
+
 template <typename T, typename V, arch_t ARCH>
 static F_INLINE void
 update_diff(const V& x, const V& y, V& d1, V& d2, const V& zero)
@@ -272,8 +445,83 @@ update_diff(const V& x, const V& y, V& d1, V& d2, const V& zero)
     d2 = blendv<ARCH>(min<T, ARCH>(d, d2), zero, mask);
 }
 
+#if defined(__AVX512BW__)
+/*
+ * AVX-512 compares into mask registers, so the blend is folded into
+ * zero-masked min/mov instead of cmpeq + blendv.
+ */
+template <>
+F_INLINE void
+init_diff<uint8_t, __m512i, USE_AVX512>(const __m512i& x, const __m512i& y,
+                                        __m512i& d1, __m512i& d2)
+{
+    const __mmask64 mask = _mm512_cmpge_epu8_mask(x, y);
+    const __m512i d = abs_diff<uint8_t, __m512i>(x, y);
+    d1 = _mm512_maskz_mov_epi8(mask, d);
+    d2 = _mm512_maskz_mov_epi8(_knot_mask64(mask), d);
+}
 
-template <typename T, typename V, int STRENGTH, arch_t ARCH>
+template <>
+F_INLINE void
+init_diff<uint16_t, __m512i, USE_AVX512>(const __m512i& x, const __m512i& y,
+                                         __m512i& d1, __m512i& d2)
+{
+    const __mmask32 mask = _mm512_cmpge_epu16_mask(x, y);
+    const __m512i d = abs_diff<uint16_t, __m512i>(x, y);
+    d1 = _mm512_maskz_mov_epi16(mask, d);
+    d2 = _mm512_maskz_mov_epi16(_knot_mask32(mask), d);
+}
+
+template <>
+F_INLINE void
+update_diff<uint8_t, __m512i, USE_AVX512>(const __m512i& x, const __m512i& y,
+                                          __m512i& d1, __m512i& d2,
+                                          const __m512i&)
+{
+    const __mmask64 mask = _mm512_cmpge_epu8_mask(x, y);
+    const __m512i d = abs_diff<uint8_t, __m512i>(x, y);
+    d1 = _mm512_maskz_min_epu8(mask, d, d1);
+    d2 = _mm512_maskz_min_epu8(_knot_mask64(mask), d, d2);
+}
+
+template <>
+F_INLINE void
+update_diff<uint16_t, __m512i, USE_AVX512>(const __m512i& x, const __m512i& y,
+                                           __m512i& d1, __m512i& d2,
+                                           const __m512i&)
+{
+    const __mmask32 mask = _mm512_cmpge_epu16_mask(x, y);
+    const __m512i d = abs_diff<uint16_t, __m512i>(x, y);
+    d1 = _mm512_maskz_min_epu16(mask, d, d1);
+    d2 = _mm512_maskz_min_epu16(_knot_mask32(mask), d, d2);
+}
+
+template <>
+F_INLINE void
+init_diff<float, __m512, USE_AVX512>(const __m512& x, const __m512& y,
+                                     __m512& d1, __m512& d2)
+{
+    const __mmask16 mask = _mm512_cmp_ps_mask(x, y, _CMP_GE_OQ);
+    const __m512 d = abs_diff<float, __m512>(x, y);
+    d1 = _mm512_maskz_mov_ps(mask, d);
+    d2 = _mm512_maskz_mov_ps(_knot_mask16(mask), d);
+}
+
+template <>
+F_INLINE void
+update_diff<float, __m512, USE_AVX512>(const __m512& x, const __m512& y,
+                                       __m512& d1, __m512& d2, const __m512&)
+{
+    const __mmask16 mask = _mm512_cmp_ps_mask(x, y, _CMP_GE_OQ);
+    const __m512 d = abs_diff<float, __m512>(x, y);
+    d1 = _mm512_maskz_min_ps(mask, d, d1);
+    d2 = _mm512_maskz_min_ps(_knot_mask16(mask), d, d2);
+}
+#endif // __AVX512BW__
+
+
+template <typename T, typename V, int STRENGTH, arch_t ARCH, access_t ACCESS,
+          store_t STORE, int PF>
 static void
 proc_a_simd(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
             const uint8_t** nextp, int dstride, int cstride, int* pstride,
@@ -298,26 +546,36 @@ proc_a_simd(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
 
     for (size_t y = 0; y < height; ++y) {
         for (size_t x = 0; x < width; x += sizeof(V)) {
-            const V curx = load<V>(currp + x);
-            V t0 = load<V>(prv1 + x);
-            V t1 = max<T, ARCH>(t0, curx);
-            V t2 = cmpeq<T>(t0, t1);
-            t0 = sub<T>(t1, min<T, ARCH>(t0, curx));
-            V d1 = and_reg(t2, t0);
-            V d2 = andnot_reg(t2, t0);
+            const size_t rem = width - x;
+            if (PF > 0 && x % 64 == 0) {
+                prefetch_ahead<PF>(currp, cstride, x, width);
+                prefetch_ahead<PF>(prv0, pstride[0], x, width);
+                prefetch_ahead<PF>(prv1, pstride[1], x, width);
+                prefetch_ahead<PF>(nxt0, nstride[0], x, width);
+                if (STRENGTH > 1) {
+                    prefetch_ahead<PF>(nxt1, nstride[1], x, width);
+                }
+                if (STRENGTH > 2) {
+                    prefetch_ahead<PF>(prv2, pstride[2], x, width);
+                    prefetch_ahead<PF>(nxt2, nstride[2], x, width);
+                }
+            }
+            const V curx = read_part<ACCESS, V>(currp + x, rem);
+            V d1, d2;
+            init_diff<T, V, ARCH>(read_part<ACCESS, V>(prv1 + x, rem), curx, d1, d2);
             if (STRENGTH > 1) {
-                update_diff<T, V, ARCH>(load<V>(nxt1 + x), curx, d1, d2, zero);
+                update_diff<T, V, ARCH>(read_part<ACCESS, V>(nxt1 + x, rem), curx, d1, d2, zero);
             }
             if (STRENGTH > 2) {
-                update_diff<T, V, ARCH>(load<V>(prv2 + x), curx, d1, d2, zero);
-                update_diff<T, V, ARCH>(load<V>(nxt2 + x), curx, d1, d2, zero);
+                update_diff<T, V, ARCH>(read_part<ACCESS, V>(prv2 + x, rem), curx, d1, d2, zero);
+                update_diff<T, V, ARCH>(read_part<ACCESS, V>(nxt2 + x, rem), curx, d1, d2, zero);
             }
-            const V pr0 = load<V>(prv0 + x);
-            const V nx0 = load<V>(nxt0 + x);
+            const V pr0 = read_part<ACCESS, V>(prv0 + x, rem);
+            const V nx0 = read_part<ACCESS, V>(nxt0 + x, rem);
             const V ul = max<T, ARCH>(sub<T>(min<T, ARCH>(pr0, nx0), d1), curx);
             const V ll = min<T, ARCH>(add<T>(max<T, ARCH>(pr0, nx0), d2), curx);
             const V avg = get_avg<T, V>(pr0, nx0, curx, q);
-            stream(dstp + x, clamp<T, V, ARCH>(avg, ll, ul));
+            write_part<STORE, ACCESS>(dstp + x, clamp<T, V, ARCH>(avg, ll, ul), rem);
         }
         prv0 += pstride[0];
         prv1 += pstride[1];
@@ -335,6 +593,98 @@ proc_a_simd(uint8_t* dstp, const uint8_t* currp, const uint8_t** prevp,
 
 }
 
+
+/*
+ * Whether the first rem (< sizeof(V)) bytes at a and b are equal. Only those
+ * are compared, since the stride padding after a row differs between frames.
+ */
+template <typename V>
+static F_INLINE bool is_same_part(const uint8_t* a, const uint8_t* b, size_t rem)
+{
+    return memcmp(a, b, rem) == 0;
+}
+
+#if defined(__AVX512BW__)
+template <>
+F_INLINE bool
+is_same_part<__m512i>(const uint8_t* a, const uint8_t* b, size_t rem)
+{
+    return is_zero(xor_reg(load_part<__m512i>(a, rem),
+                           load_part<__m512i>(b, rem)));
+}
+#endif
+
+
+template <typename V>
+static F_INLINE bool
+is_static_tile_simd(const uint8_t* currp, const uint8_t* const* srcp, int num,
+                    size_t x, size_t bytes)
+{
+    constexpr size_t N = STATIC_TILE_SIZE / sizeof(V);
+    if (bytes == STATIC_TILE_SIZE) {
+        V cur[N];
+        for (size_t j = 0; j < N; ++j) {
+            cur[j] = load<V>(currp + x + j * sizeof(V));
+        }
+        for (int i = 0; i < num; ++i) {
+            V d = xor_reg(cur[0], load<V>(srcp[i] + x));
+            for (size_t j = 1; j < N; ++j) {
+                d = or_reg(d, xor_reg(cur[j], load<V>(srcp[i] + x + j * sizeof(V))));
+            }
+            if (!is_zero(d)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the last tile of a row: whole vectors, then the bytes left.
+    for (int i = 0; i < num; ++i) {
+        V d = setzero<V>();
+        size_t o = 0;
+        for (; o + sizeof(V) <= bytes; o += sizeof(V)) {
+            d = or_reg(d, xor_reg(load<V>(currp + x + o),
+                                  load<V>(srcp[i] + x + o)));
+        }
+        if (!is_zero(d)) {
+            return false;
+        }
+        if (o < bytes
+                && !is_same_part<V>(currp + x + o, srcp[i] + x + o, bytes - o)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <>
+F_INLINE bool
+is_static_tile<__m128i>(const uint8_t* currp, const uint8_t* const* srcp,
+                        int num, size_t x, size_t bytes)
+{
+    return is_static_tile_simd<__m128i>(currp, srcp, num, x, bytes);
+}
+
+#if defined(__AVX2__)
+template <>
+F_INLINE bool
+is_static_tile<__m256i>(const uint8_t* currp, const uint8_t* const* srcp,
+                        int num, size_t x, size_t bytes)
+{
+    return is_static_tile_simd<__m256i>(currp, srcp, num, x, bytes);
+}
+#endif
+
+#if defined(__AVX512BW__)
+template <>
+F_INLINE bool
+is_static_tile<__m512i>(const uint8_t* currp, const uint8_t* const* srcp,
+                        int num, size_t x, size_t bytes)
+{
+    return is_static_tile_simd<__m512i>(currp, srcp, num, x, bytes);
+}
+#endif
+
 #endif // __SSE2__
 
 #endif
@@ -0,0 +1,135 @@
+/*
+proc_filter_sse41.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "get_proc.h"
+#include "proc_filter.h"
+
+
+#if defined(__SSE4_1__)
+
+// strength 1 has no prefetch variants.
+template <access_t ACCESS, store_t STORE, int PF>
+static proc_filter_t
+main_table(int strength, bool aggressive, int bits_per_sample)
+{
+    std::map<proc_key_t, proc_filter_t> table;
+
+    table[make_key(1, false, 8)] = proc_simd<uint8_t, __m128i, 1, USE_SSE2, ACCESS, STORE, 0>;
+    table[make_key(1, false, 16)] = proc_simd<uint16_t, __m128i, 1, USE_SSE41, ACCESS, STORE, 0>;
+    table[make_key(1, false, 32)] = proc_simd<float, __m128, 1, USE_SSE2, ACCESS, STORE, 0>;
+
+    table[make_key(2, false, 8)] = proc_simd<uint8_t, __m128i, 2, USE_SSE2, ACCESS, STORE, PF>;
+    table[make_key(2, false, 16)] = proc_simd<uint16_t, __m128i, 2, USE_SSE41, ACCESS, STORE, PF>;
+    table[make_key(2, false, 32)] = proc_simd<float, __m128, 2, USE_SSE2, ACCESS, STORE, PF>;
+
+    table[make_key(3, false, 8)] = proc_simd<uint8_t, __m128i, 3, USE_SSE2, ACCESS, STORE, PF>;
+    table[make_key(3, false, 16)] = proc_simd<uint16_t, __m128i, 3, USE_SSE41, ACCESS, STORE, PF>;
+    table[make_key(3, false, 32)] = proc_simd<float, __m128, 3, USE_SSE2, ACCESS, STORE, PF>;
+
+    table[make_key(1, true, 8)] = proc_a_simd<uint8_t, __m128i, 1, USE_SSE41, ACCESS, STORE, 0>;
+    table[make_key(1, true, 16)] = proc_a_simd<uint16_t, __m128i, 1, USE_SSE41, ACCESS, STORE, 0>;
+    table[make_key(1, true, 32)] = proc_a_simd<float, __m128, 1, USE_SSE41, ACCESS, STORE, 0>;
+
+    table[make_key(2, true, 8)] = proc_a_simd<uint8_t, __m128i, 2, USE_SSE41, ACCESS, STORE, PF>;
+    table[make_key(2, true, 16)] = proc_a_simd<uint16_t, __m128i, 2, USE_SSE41, ACCESS, STORE, PF>;
+    table[make_key(2, true, 32)] = proc_a_simd<float, __m128, 2, USE_SSE41, ACCESS, STORE, PF>;
+
+    table[make_key(3, true, 8)] = proc_a_simd<uint8_t, __m128i, 3, USE_SSE41, ACCESS, STORE, PF>;
+    table[make_key(3, true, 16)] = proc_a_simd<uint16_t, __m128i, 3, USE_SSE41, ACCESS, STORE, PF>;
+    table[make_key(3, true, 32)] = proc_a_simd<float, __m128, 3, USE_SSE41, ACCESS, STORE, PF>;
+
+    return table[make_key(strength, aggressive, bits_per_sample)];
+}
+
+
+template <access_t ACCESS, store_t STORE>
+static proc_filter_t
+main_table(int strength, bool aggressive, int bits_per_sample, int prefetch)
+{
+    switch (prefetch) {
+    case 256:
+        return main_table<ACCESS, STORE, 256>(strength, aggressive, bits_per_sample);
+    case 512:
+        return main_table<ACCESS, STORE, 512>(strength, aggressive, bits_per_sample);
+    case 1024:
+        return main_table<ACCESS, STORE, 1024>(strength, aggressive, bits_per_sample);
+    case 2048:
+        return main_table<ACCESS, STORE, 2048>(strength, aggressive, bits_per_sample);
+    default:
+        return main_table<ACCESS, STORE, 0>(strength, aggressive, bits_per_sample);
+    }
+}
+
+
+proc_filter_t
+get_main_proc_sse41(int strength, bool aggressive, int bits_per_sample,
+                    store_t store, int prefetch, access_t access)
+{
+    if (access == ACCESS_UNALIGNED) {
+        return store == STORE_TEMPORAL
+            ? main_table<ACCESS_UNALIGNED, STORE_TEMPORAL>(
+                  strength, aggressive, bits_per_sample, prefetch)
+            : main_table<ACCESS_UNALIGNED, STORE_STREAM>(
+                  strength, aggressive, bits_per_sample, prefetch);
+    }
+    return store == STORE_TEMPORAL
+        ? main_table<ACCESS_ALIGNED, STORE_TEMPORAL>(
+              strength, aggressive, bits_per_sample, prefetch)
+        : main_table<ACCESS_ALIGNED, STORE_STREAM>(
+              strength, aggressive, bits_per_sample, prefetch);
+}
+
+
+proc_static_t
+get_static_proc_sse41(int strength, int bits_per_sample)
+{
+    std::map<proc_key_t, proc_static_t> table;
+
+    table[make_key(1, false, 8)] = proc_s<uint8_t, __m128i, 1>;
+    table[make_key(1, false, 16)] = proc_s<uint16_t, __m128i, 1>;
+    table[make_key(1, false, 32)] = proc_s<float, __m128i, 1>;
+
+    table[make_key(2, false, 8)] = proc_s<uint8_t, __m128i, 2>;
+    table[make_key(2, false, 16)] = proc_s<uint16_t, __m128i, 2>;
+    table[make_key(2, false, 32)] = proc_s<float, __m128i, 2>;
+
+    table[make_key(3, false, 8)] = proc_s<uint8_t, __m128i, 3>;
+    table[make_key(3, false, 16)] = proc_s<uint16_t, __m128i, 3>;
+    table[make_key(3, false, 32)] = proc_s<float, __m128i, 3>;
+
+    return table[make_key(strength, false, bits_per_sample)];
+}
+
+#else
+
+proc_filter_t get_main_proc_sse41(int, bool, int, store_t, int, access_t)
+{
+    return nullptr;
+}
+
+proc_static_t get_static_proc_sse41(int, int)
+{
+    return nullptr;
+}
+
+#endif // __SSE4_1__
@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 #define REDUCE_FLICKER_SIMD_H
 
 #include <cstdint>
+#include <cstring>
 #include "arch.h"
 #include <immintrin.h>
 
@@ -57,6 +58,19 @@ F_INLINE __m256 load(const uint8_t* p)
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <>
+F_INLINE __m512i load(const uint8_t* p)
+{
+    return _mm512_loadu_si512(p);
+}
+template <>
+F_INLINE __m512 load(const uint8_t* p)
+{
+    return _mm512_loadu_ps(p);
+}
+#endif
+
 /********************* STORE *************************************/
 static F_INLINE void stream(uint8_t* p, const __m128i& x)
 {
@@ -80,6 +94,238 @@ static F_INLINE void stream(uint8_t* p, const __m256& x)
 }
 #endif
 
+#if defined(__AVX512BW__)
+static F_INLINE void stream(uint8_t* p, const __m512i& x)
+{
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(p), x);
+}
+
+static F_INLINE void stream(uint8_t* p, const __m512& x)
+{
+    _mm512_stream_ps(reinterpret_cast<float*>(p), x);
+}
+#endif
+
+static F_INLINE void store(uint8_t* p, const __m128i& x)
+{
+    _mm_store_si128(reinterpret_cast<__m128i*>(p), x);
+}
+
+static F_INLINE void store(uint8_t* p, const __m128& x)
+{
+    _mm_store_ps(reinterpret_cast<float*>(p), x);
+}
+
+#if defined(__AVX2__)
+static F_INLINE void store(uint8_t* p, const __m256i& x)
+{
+    _mm256_store_si256(reinterpret_cast<__m256i*>(p), x);
+}
+
+static F_INLINE void store(uint8_t* p, const __m256& x)
+{
+    _mm256_store_ps(reinterpret_cast<float*>(p), x);
+}
+#endif
+
+#if defined(__AVX512BW__)
+static F_INLINE void store(uint8_t* p, const __m512i& x)
+{
+    _mm512_storeu_si512(p, x);
+}
+
+static F_INLINE void store(uint8_t* p, const __m512& x)
+{
+    _mm512_storeu_ps(p, x);
+}
+#endif
+
+/********************* PARTIAL LOAD/STORE **************************/
+/*
+ * rem is the number of bytes left in the row. The aligned 128/256-bit kernels
+ * read and write whole vectors into the stride padding, so they ignore it.
+ * AVX-512 vectors can be wider than that padding, so the last vector of
+ * each row is masked.
+ */
+template <typename V>
+static F_INLINE V load_part(const uint8_t* p, size_t)
+{
+    return load<V>(p);
+}
+
+template <typename V>
+static F_INLINE void stream_part(uint8_t* p, const V& x, size_t)
+{
+    stream(p, x);
+}
+
+template <typename V>
+static F_INLINE void store_part(uint8_t* p, const V& x, size_t)
+{
+    store(p, x);
+}
+
+#if defined(__AVX512BW__)
+static F_INLINE __mmask64 tail_mask(size_t rem)
+{
+    return rem >= 64 ? ~0ULL : (1ULL << rem) - 1;
+}
+
+template <>
+F_INLINE __m512i load_part<__m512i>(const uint8_t* p, size_t rem)
+{
+    return _mm512_maskz_loadu_epi8(tail_mask(rem), p);
+}
+
+static F_INLINE void stream_part(uint8_t* p, const __m512i& x, size_t rem)
+{
+    // frame buffers are not guaranteed to be 64 byte aligned.
+    if (rem >= 64 && (reinterpret_cast<uintptr_t>(p) & 63) == 0) {
+        stream(p, x);
+        return;
+    }
+    _mm512_mask_storeu_epi8(p, tail_mask(rem), x);
+}
+
+static F_INLINE void store_part(uint8_t* p, const __m512i& x, size_t rem)
+{
+    if (rem >= 64) {
+        store(p, x);
+        return;
+    }
+    _mm512_mask_storeu_epi8(p, tail_mask(rem), x);
+}
+
+template <>
+F_INLINE __m512 load_part<__m512>(const uint8_t* p, size_t rem)
+{
+    const __mmask16 mask = static_cast<__mmask16>(tail_mask(rem / 4));
+    return _mm512_maskz_loadu_ps(mask, p);
+}
+
+static F_INLINE void stream_part(uint8_t* p, const __m512& x, size_t rem)
+{
+    if (rem >= 64 && (reinterpret_cast<uintptr_t>(p) & 63) == 0) {
+        stream(p, x);
+        return;
+    }
+    const __mmask16 mask = static_cast<__mmask16>(tail_mask(rem / 4));
+    _mm512_mask_storeu_ps(p, mask, x);
+}
+
+static F_INLINE void store_part(uint8_t* p, const __m512& x, size_t rem)
+{
+    if (rem >= 64) {
+        store(p, x);
+        return;
+    }
+    const __mmask16 mask = static_cast<__mmask16>(tail_mask(rem / 4));
+    _mm512_mask_storeu_ps(p, mask, x);
+}
+#endif
+
+/********************* UNALIGNED LOAD/STORE ************************/
+template <typename V> static F_INLINE V loadu(const uint8_t* p);
+
+template <>
+F_INLINE __m128i loadu<__m128i>(const uint8_t* p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+template <>
+F_INLINE __m128 loadu(const uint8_t* p)
+{
+    return _mm_loadu_ps(reinterpret_cast<const float*>(p));
+}
+#if defined(__AVX2__)
+template <>
+F_INLINE __m256i loadu(const uint8_t* p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+template <>
+F_INLINE __m256 loadu(const uint8_t* p)
+{
+    return _mm256_loadu_ps(reinterpret_cast<const float*>(p));
+}
+#endif
+
+static F_INLINE void storeu(uint8_t* p, const __m128i& x)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x);
+}
+
+static F_INLINE void storeu(uint8_t* p, const __m128& x)
+{
+    _mm_storeu_ps(reinterpret_cast<float*>(p), x);
+}
+
+#if defined(__AVX2__)
+static F_INLINE void storeu(uint8_t* p, const __m256i& x)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x);
+}
+
+static F_INLINE void storeu(uint8_t* p, const __m256& x)
+{
+    _mm256_storeu_ps(reinterpret_cast<float*>(p), x);
+}
+#endif
+
+/*
+ * For rows which are views into other buffers (crops, external memory):
+ * neither the alignment nor any padding after the row can be assumed, so
+ * nothing at or past p + rem is touched. A partial vector goes through a
+ * buffer on the stack. The AVX-512 versions above are already exact.
+ */
+template <typename V>
+static F_INLINE V loadu_part(const uint8_t* p, size_t rem)
+{
+    if (rem >= sizeof(V)) {
+        return loadu<V>(p);
+    }
+    alignas(64) uint8_t buff[sizeof(V)] = {};
+    memcpy(buff, p, rem);
+    return load<V>(buff);
+}
+
+template <typename V>
+static F_INLINE void storeu_part(uint8_t* p, const V& x, size_t rem)
+{
+    if (rem >= sizeof(V)) {
+        storeu(p, x);
+        return;
+    }
+    alignas(64) uint8_t buff[sizeof(V)];
+    store(buff, x);
+    memcpy(p, buff, rem);
+}
+
+#if defined(__AVX512BW__)
+template <>
+F_INLINE __m512i loadu_part<__m512i>(const uint8_t* p, size_t rem)
+{
+    return load_part<__m512i>(p, rem);
+}
+
+template <>
+F_INLINE __m512 loadu_part<__m512>(const uint8_t* p, size_t rem)
+{
+    return load_part<__m512>(p, rem);
+}
+
+static F_INLINE void storeu_part(uint8_t* p, const __m512i& x, size_t rem)
+{
+    store_part(p, x, rem);
+}
+
+static F_INLINE void storeu_part(uint8_t* p, const __m512& x, size_t rem)
+{
+    store_part(p, x, rem);
+}
+#endif
+
+
 /************************ SETZERO *********************************/
 template <typename V> static F_INLINE V setzero();
 
@@ -107,6 +353,19 @@ F_INLINE __m256 setzero<__m256>()
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <>
+F_INLINE __m512i setzero<__m512i>()
+{
+    return _mm512_setzero_si512();
+}
+template <>
+F_INLINE __m512 setzero<__m512>()
+{
+    return _mm512_setzero_ps();
+}
+#endif
+
 
 /*********************** SET1 *************************************/
 template <typename T, typename V> static F_INLINE V set1();
@@ -154,6 +413,24 @@ F_INLINE __m256 set1<float>()
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <>
+F_INLINE __m512i set1<uint8_t>()
+{
+    return _mm512_set1_epi8(1);
+}
+template <>
+F_INLINE __m512i set1<uint16_t>()
+{
+    return _mm512_set1_epi16(1);
+}
+template <>
+F_INLINE __m512 set1<float>()
+{
+    return _mm512_set1_ps(0.25f);
+}
+#endif
+
 /********************* BIT OR *************************************/
 static F_INLINE __m128 or_reg(const __m128& x, const __m128& y)
 {
@@ -175,6 +452,13 @@ static F_INLINE __m256i or_reg(const __m256i& x, const __m256i& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+static F_INLINE __m512i or_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_or_si512(x, y);
+}
+#endif
+
 /********************* BIT AND *************************************/
 static F_INLINE __m128 and_reg(const __m128& x, const __m128& y)
 {
@@ -196,6 +480,13 @@ static F_INLINE __m256i and_reg(const __m256i& x, const __m256i& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+static F_INLINE __m512i and_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_and_si512(x, y);
+}
+#endif
+
 /********************* BIT XOR *************************************/
 static F_INLINE __m128 xor_reg(const __m128& x, const __m128& y)
 {
@@ -217,6 +508,13 @@ static F_INLINE __m256i xor_reg(const __m256i& x, const __m256i& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+static F_INLINE __m512i xor_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_xor_si512(x, y);
+}
+#endif
+
 /********************* BIT ANDNOT *********************************/
 static F_INLINE __m128 andnot_reg(const __m128& x, const __m128& y)
 {
@@ -238,6 +536,13 @@ static F_INLINE __m256i andnot_reg(const __m256i& x, const __m256i& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+static F_INLINE __m512i andnot_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_andnot_si512(x, y);
+}
+#endif
+
 /************************ COMPEQ *********************************/
 template <typename T>
 static F_INLINE __m128i cmpeq(const __m128i& x, const __m128i& y)
@@ -310,6 +615,24 @@ static F_INLINE __m256 sub(const __m256& x, const __m256& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <typename T>
+static F_INLINE __m512i sub(const __m512i& x, const __m512i& y)
+{
+    return _mm512_subs_epu16(x, y);
+}
+template <>
+F_INLINE __m512i sub<uint8_t>(const __m512i& x, const __m512i& y)
+{
+    return _mm512_subs_epu8(x, y);
+}
+template <typename T>
+static F_INLINE __m512 sub(const __m512& x, const __m512& y)
+{
+    return _mm512_sub_ps(x, y);
+}
+#endif
+
 /************************** ADD *************************************/
 template <typename T>
 static F_INLINE __m128i add(const __m128i& x, const __m128i& y)
@@ -347,6 +670,24 @@ static F_INLINE __m256 add(const __m256& x, const __m256& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <typename T>
+static F_INLINE __m512i add(const __m512i& x, const __m512i& y)
+{
+    return _mm512_adds_epu16(x, y);
+}
+template <>
+F_INLINE __m512i add<uint8_t>(const __m512i& x, const __m512i& y)
+{
+    return _mm512_adds_epu8(x, y);
+}
+template <typename T>
+static F_INLINE __m512 add(const __m512& x, const __m512& y)
+{
+    return _mm512_add_ps(x, y);
+}
+#endif
+
 /************************ MAX ************************************/
 template <typename T, arch_t ARCH>
 static F_INLINE __m128 max(const __m128& x, const __m128& y)
@@ -401,6 +742,24 @@ F_INLINE __m256i max<uint8_t, USE_AVX2>(const __m256i& x, const __m256i& y)
     return _mm256_max_epu8(x, y);
 }
 #endif // __AVX2__
+#if defined(__AVX512BW__)
+template <typename T, arch_t ARCH>
+static F_INLINE __m512 max(const __m512& x, const __m512& y)
+{
+    return _mm512_max_ps(x, y);
+}
+
+template <typename T, arch_t ARCH>
+static F_INLINE __m512i max(const __m512i& x, const __m512i& y)
+{
+    return _mm512_max_epu16(x, y);
+}
+template <>
+F_INLINE __m512i max<uint8_t, USE_AVX512>(const __m512i& x, const __m512i& y)
+{
+    return _mm512_max_epu8(x, y);
+}
+#endif // __AVX512BW__
 #endif // __SSE4_1__
 
 
@@ -458,8 +817,50 @@ F_INLINE __m256i min<uint8_t, USE_AVX2>(const __m256i& x, const __m256i& y)
     return _mm256_min_epu8(x, y);
 }
 #endif // __AVX2__
+#if defined(__AVX512BW__)
+template <typename T, arch_t ARCH>
+static F_INLINE __m512 min(const __m512& x, const __m512& y)
+{
+    return _mm512_min_ps(x, y);
+}
+
+template <typename T, arch_t ARCH>
+static F_INLINE __m512i min(const __m512i& x, const __m512i& y)
+{
+    return _mm512_min_epu16(x, y);
+}
+template <>
+F_INLINE __m512i min<uint8_t, USE_AVX512>(const __m512i& x, const __m512i& y)
+{
+    return _mm512_min_epu8(x, y);
+}
+#endif // __AVX512BW__
 #endif // __SSE4_1__
 
+/****************************** IS_ZERO *************************************/
+static F_INLINE bool is_zero(const __m128i& x)
+{
+#if defined(__SSE4_1__)
+    return _mm_testz_si128(x, x) != 0;
+#else
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) == 0xFFFF;
+#endif
+}
+
+#if defined(__AVX2__)
+static F_INLINE bool is_zero(const __m256i& x)
+{
+    return _mm256_testz_si256(x, x) != 0;
+}
+#endif
+
+#if defined(__AVX512BW__)
+static F_INLINE bool is_zero(const __m512i& x)
+{
+    return _mm512_test_epi64_mask(x, x) == 0;
+}
+#endif
+
 /***************************** ABS_DIFF *************************************/
 template <typename T, typename V>
 static F_INLINE V abs_diff(const V& x, const V& y)
@@ -479,6 +880,13 @@ F_INLINE __m256 abs_diff<float>(const __m256& x, const __m256& y)
     return _mm256_sub_ps(_mm256_max_ps(x, y), _mm256_min_ps(x, y));
 }
 #endif // __AVX2__
+#if defined(__AVX512BW__)
+template <>
+F_INLINE __m512 abs_diff<float>(const __m512& x, const __m512& y)
+{
+    return _mm512_sub_ps(_mm512_max_ps(x, y), _mm512_min_ps(x, y));
+}
+#endif // __AVX512BW__
 
 /***************************** CLAMP **************************************/
 template <typename T, typename V, arch_t ARCH>
@@ -512,6 +920,19 @@ F_INLINE __m256i average<uint8_t>(const __m256i& x, const __m256i& y)
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <typename T>
+static F_INLINE __m512i average(const __m512i& x, const __m512i& y)
+{
+    return _mm512_avg_epu16(x, y);
+}
+template <>
+F_INLINE __m512i average<uint8_t>(const __m512i& x, const __m512i& y)
+{
+    return _mm512_avg_epu8(x, y);
+}
+#endif
+
 template <typename T, typename V>
 static F_INLINE V get_avg(const V& a, const V& b, const V& x, const V& q)
 {
@@ -539,6 +960,17 @@ get_avg<float, __m256>(const __m256& a, const __m256& b, const __m256& x, const
 }
 #endif
 
+#if defined(__AVX512BW__)
+template <>
+F_INLINE __m512
+get_avg<float, __m512>(const __m512& a, const __m512& b, const __m512& x, const __m512& q)
+{
+    // x * 2 is exact, so the fma rounds the same as (a + b) + (x + x).
+    __m512 t = _mm512_fmadd_ps(x, _mm512_set1_ps(2.0f), _mm512_add_ps(a, b));
+    return _mm512_mul_ps(t, q);
+}
+#endif
+
 /****************************** BLENDV *************************/
 template <arch_t ARCH>
 static F_INLINE __m128
@@ -550,7 +982,7 @@ template <arch_t ARCH>
 static F_INLINE __m128i
 blendv(const __m128i& x, const __m128i& y, const __m128i& mask)
 {
-    return _mm_or_si128(_mm_and_si128(mask, y), _mm_andnot_si128(mask, y));
+    return _mm_or_si128(_mm_and_si128(mask, y), _mm_andnot_si128(mask, x));
 }
 #if defined(__SSE4_1__)
 template <>
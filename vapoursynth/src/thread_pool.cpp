@@ -0,0 +1,123 @@
+/*
+thread_pool.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+
+#include "thread_pool.h"
+
+
+ThreadPool::ThreadPool(int num_workers) : quit(false)
+{
+    for (int i = 0; i < num_workers; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        quit = true;
+    }
+    wakeup.notify_all();
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+
+// Processes stripes of b until none is left to take.
+void ThreadPool::work(Batch* b)
+{
+    size_t i;
+    while ((i = b->next.fetch_add(1)) < b->count) {
+        (*b->job)(i);
+        b->done.fetch_add(1);
+    }
+}
+
+
+void ThreadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        wakeup.wait(lock, [this] { return quit || !batches.empty(); });
+        if (quit) {
+            return;
+        }
+        Batch* b = batches.front();
+        if (b->next.load() >= b->count) {
+            // all stripes are taken, the owner removes it when they are done.
+            batches.pop_front();
+            continue;
+        }
+        // the owner does not return while a worker still holds b.
+        ++b->active;
+        lock.unlock();
+        work(b);
+        lock.lock();
+        if (--b->active == 0) {
+            finished.notify_all();
+        }
+    }
+}
+
+
+/*
+ * Calls job(0) ... job(count - 1) and returns when all of them are done.
+ * The calling thread processes stripes too.
+ */
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& job)
+{
+    if (workers.empty() || count < 2) {
+        for (size_t i = 0; i < count; ++i) {
+            job(i);
+        }
+        return;
+    }
+
+    Batch b;
+    b.job = &job;
+    b.count = count;
+    b.next = 0;
+    b.done = 0;
+    b.active = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        batches.push_back(&b);
+    }
+    wakeup.notify_all();
+
+    work(&b);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    finished.wait(lock, [&b] {
+        return b.done.load() == b.count && b.active == 0;
+    });
+    for (auto it = batches.begin(); it != batches.end(); ++it) {
+        if (*it == &b) {
+            batches.erase(it);
+            break;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+/*
+trace.cpp: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "trace.h"
+
+#if defined(RDFL_TRACE)
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+
+/*
+ * The events are appended to the file as a JSON array which is never closed.
+ * The trace viewers accept that, so nothing has to run at exit.
+ */
+namespace {
+
+struct Writer {
+    FILE* fp;
+    std::mutex mtx;
+    std::chrono::steady_clock::time_point origin;
+
+    Writer() : fp(nullptr), origin(std::chrono::steady_clock::now())
+    {
+        const char* path = std::getenv("RDFL_TRACE_FILE");
+        if (path && *path) {
+            fp = std::fopen(path, "w");
+        }
+        if (fp) {
+            std::fputs("[\n", fp);
+        }
+    }
+};
+
+Writer& writer()
+{
+    static Writer w;
+    return w;
+}
+
+int thread_id()
+{
+    static std::atomic<int> next(1);
+    thread_local int id = next++;
+    return id;
+}
+
+}
+
+
+bool trace::enabled()
+{
+    return writer().fp != nullptr;
+}
+
+
+// microseconds since the first event.
+uint64_t trace::now()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+        steady_clock::now() - writer().origin).count();
+}
+
+
+void trace::complete(const char* name, uint64_t start, int frame, int plane)
+{
+    uint64_t end = now();
+    Writer& w = writer();
+    std::lock_guard<std::mutex> lock(w.mtx);
+    std::fprintf(w.fp,
+        "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+        "\"ts\":%llu,\"dur\":%llu,\"args\":{\"frame\":%d",
+        name, thread_id(), static_cast<unsigned long long>(start),
+        static_cast<unsigned long long>(end - start), frame);
+    if (plane >= 0) {
+        std::fprintf(w.fp, ",\"plane\":%d", plane);
+    }
+    std::fputs("}},\n", w.fp);
+}
+
+
+// async events are paired by instance and frame number, so they may end on
+// another thread.
+void trace::async(const char* name, char phase, const void* instance,
+                  int frame)
+{
+    if (!enabled()) {
+        return;
+    }
+    uint64_t ts = now();
+    Writer& w = writer();
+    std::lock_guard<std::mutex> lock(w.mtx);
+    std::fprintf(w.fp,
+        "{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":\"%llx:%d\","
+        "\"pid\":1,\"tid\":%d,\"ts\":%llu,\"args\":{\"frame\":%d}},\n",
+        name, phase,
+        static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(instance)),
+        frame, thread_id(), static_cast<unsigned long long>(ts), frame);
+}
+
+
+void trace::flush()
+{
+    if (!enabled()) {
+        return;
+    }
+    Writer& w = writer();
+    std::lock_guard<std::mutex> lock(w.mtx);
+    std::fflush(w.fp);
+}
+
+#endif // RDFL_TRACE
@@ -0,0 +1,85 @@
+/*
+trace.h: Copyright (C) 2016  Oka Motofumi
+
+Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+This file is part of ReduceFlicker.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with the author; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef REDUCE_FLICKER_TRACE_H
+#define REDUCE_FLICKER_TRACE_H
+
+/*
+ * Chrome trace event output (chrome://tracing, ui.perfetto.dev).
+ * Only built when RDFL_TRACE is defined (cmake -DRDFL_TRACE=ON). Events are
+ * written only when the environment variable RDFL_TRACE_FILE names the
+ * output file. Without RDFL_TRACE every macro expands to nothing.
+ */
+#if defined(RDFL_TRACE)
+
+#include <cstdint>
+
+
+namespace trace {
+
+bool enabled();
+uint64_t now();
+void complete(const char* name, uint64_t start, int frame, int plane);
+// instance tells apart filters which wait for the same frame number.
+void async(const char* name, char phase, const void* instance, int frame);
+void flush();
+
+class Scope {
+    const char* name;
+    int frame;
+    int plane;
+    uint64_t start;
+
+public:
+    Scope(const char* n, int f, int p=-1) :
+        name(n), frame(f), plane(p), start(enabled() ? now() : 0) {}
+    ~Scope()
+    {
+        if (enabled()) {
+            complete(name, start, frame, plane);
+        }
+    }
+};
+
+}
+
+#define RDFL_TRACE_CAT2(a, b) a##b
+#define RDFL_TRACE_CAT(a, b) RDFL_TRACE_CAT2(a, b)
+#define TRACE_SCOPE(...) \
+    trace::Scope RDFL_TRACE_CAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define TRACE_ASYNC_BEGIN(name, instance, frame) \
+    trace::async(name, 'b', instance, frame)
+#define TRACE_ASYNC_END(name, instance, frame) \
+    trace::async(name, 'e', instance, frame)
+#define TRACE_FLUSH() trace::flush()
+
+#else
+
+#define TRACE_SCOPE(...)
+#define TRACE_ASYNC_BEGIN(name, instance, frame)
+#define TRACE_ASYNC_END(name, instance, frame)
+#define TRACE_FLUSH()
+
+#endif // RDFL_TRACE
+
+#endif